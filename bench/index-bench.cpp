@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "svm.h"
+#include "group_varint.h"
+
+#define Malloc(type,n) (type *)malloc((n)*sizeof(type))
+
+void exit_with_help()
+{
+	printf(
+	"Usage: index-bench [options]\n"
+	"Times the sparse dot products of the CPU kernel on random rows, merging\n"
+	"svm_node arrays against merging group-varint coded indices (svm-train -I 1).\n"
+	"options:\n"
+	"-l n : number of rows (default 2000)\n"
+	"-d n : number of features (default 100000)\n"
+	"-k n : nonzeros per row (default 100)\n"
+	"-c n : number of kernel columns computed, each against all rows (default 500)\n"
+	);
+	exit(1);
+}
+
+static double wall_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Kernel::dot
+static double dot(const svm_node *px, const svm_node *py)
+{
+	double sum = 0;
+	while(px->index != -1 && py->index != -1)
+	{
+		if(px->index == py->index)
+		{
+			sum += px->value * py->value;
+			++px;
+			++py;
+		}
+		else
+		{
+			if(px->index > py->index)
+				++py;
+			else
+				++px;
+		}
+	}
+	return sum;
+}
+
+static uint64_t state = 88172645463325252ULL;
+static uint64_t next_random()
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+int main(int argc, char **argv)
+{
+	int l = 2000, d = 100000, k = 100, c = 500;
+	int i, j;
+	for(i=1;i<argc;i++)
+	{
+		if(argv[i][0] != '-' || ++i >= argc)
+			exit_with_help();
+		switch(argv[i-1][1])
+		{
+			case 'l': l = atoi(argv[i]); break;
+			case 'd': d = atoi(argv[i]); break;
+			case 'k': k = atoi(argv[i]); break;
+			case 'c': c = atoi(argv[i]); break;
+			default:
+				fprintf(stderr,"Unknown option: -%c\n", argv[i-1][1]);
+				exit_with_help();
+		}
+	}
+	if(l < 1 || k < 1 || d < k || c < 1)
+		exit_with_help();
+	if(c > l)
+		c = l;
+
+	// rows of k distinct sorted random features; features are drawn with a
+	// skew so that rows share some of them
+	svm_node *x_space = Malloc(svm_node,(size_t)l*(k+1));
+	svm_node **x = Malloc(svm_node *,l);
+	int *idx = Malloc(int,k);
+	for(i=0;i<l;i++)
+	{
+		int n = 0;
+		while(n < k)
+		{
+			uint64_t r = next_random();
+			int f = 1 + (int)((r % (uint64_t)d) * ((r >> 40) % 1024) / 1024);
+			for(j=0;j<n && idx[j] != f;j++)
+				;
+			if(j == n)
+				idx[n++] = f;
+		}
+		qsort(idx,k,sizeof(int),compare_int);
+		x[i] = &x_space[(size_t)i*(k+1)];
+		for(j=0;j<k;j++)
+		{
+			x[i][j].index = idx[j];
+			x[i][j].value = (double)(next_random() % 1000) / 1000;
+		}
+		x[i][k].index = -1;
+	}
+
+	double t = wall_time();
+	GroupVarintRows rows(l,x);
+	double encode_time = wall_time() - t;
+
+	double sum_node = 0, sum_coded = 0;
+	t = wall_time();
+	for(i=0;i<c;i++)
+		for(j=0;j<l;j++)
+			sum_node += dot(x[i],x[j]);
+	double node_time = wall_time() - t;
+
+	t = wall_time();
+	for(i=0;i<c;i++)
+		for(j=0;j<l;j++)
+			sum_coded += GroupVarintRows::dot(rows.row(i),rows.row(j));
+	double coded_time = wall_time() - t;
+
+	double nr_dot = (double)l*c;
+	printf("rows = %d, features = %d, nonzeros per row = %d, dot products = %g\n",l,d,k,nr_dot);
+#ifdef __SSSE3__
+	printf("decoder: SSSE3\n");
+#else
+	printf("decoder: scalar\n");
+#endif
+	printf("index bytes: svm_node %g, group varint %g (%.2f per index), encoded in %g s\n",
+		(double)l*(k+1)*sizeof(svm_node),(double)rows.index_bytes(),
+		(double)rows.index_bytes()/((double)l*k),encode_time);
+	printf("svm_node merge: %g ns per dot\n",1e9*node_time/nr_dot);
+	printf("group varint:   %g ns per dot (%.2fx)\n",1e9*coded_time/nr_dot,node_time/coded_time);
+	if(sum_node != sum_coded)
+	{
+		printf("MISMATCH: %.17g != %.17g\n",sum_node,sum_coded);
+		return 1;
+	}
+
+	free(idx);
+	free(x);
+	free(x_space);
+	return 0;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include "svm.h"
+#include "reduce.h"
+#include "svm_device.h"
+
+#define Malloc(type,n) (type *)malloc((n)*sizeof(type))
+
+void exit_with_help()
+{
+	printf(
+	"Usage: reduce-check [options]\n"
+	"Checks that host_reduce finds the same maximum, minimum and index with any\n"
+	"number of threads as a serial scan, equal values going to the larger index,\n"
+	"including ties across the thread splits and ranges where nothing is kept.\n"
+	"options:\n"
+	"-t n : largest number of threads tried (default 8)\n"
+	"-C : also check the device reducers of the cuda solver against the host\n"
+	"-b n : block size of the device reductions (default 256)\n"
+	);
+	exit(1);
+}
+
+static uint64_t state = 88172645463325252ULL;
+static uint64_t next_random()
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+enum { KEEP_ALL, KEEP_SOME, KEEP_NONE }; // which elements the reduction folds in
+
+static bool kept(int t, int filter)
+{
+	return filter == KEEP_ALL || (filter == KEEP_SOME && t % 3 != 0);
+}
+
+static const char *filter_name[] = { "all", "some", "none" };
+
+static int nr_mismatch = 0;
+
+static void check(const char *what, int n, int nr_thread, int filter, double value, int idx, double expect_value, int expect_idx)
+{
+	if (value != expect_value || idx != expect_idx) {
+		printf("MISMATCH %s: n = %d, threads = %d, kept = %s: (%g, %d) instead of (%g, %d)\n",
+			what, n, nr_thread, filter_name[filter], value, idx, expect_value, expect_idx);
+		++nr_mismatch;
+	}
+}
+
+// host_reduce against the >= and <= scans of Solver::select_working_set: the maximum
+// of v and the minimum and maximum of v2
+static void check_host(const GradValue_t *v, const GradValue_t *v2, int n, int nr_thread, int filter)
+{
+	GradValue_t max = -GRADVALUE_MAX, min = GRADVALUE_MAX, max2 = -GRADVALUE_MAX;
+	int max_idx = -1, min_idx = -1;
+	for (int t = 0; t < n; t++) {
+		if (!kept(t, filter))
+			continue;
+		if (v[t] >= max) {
+			max = v[t];
+			max_idx = t;
+		}
+		if (v2[t] <= min) {
+			min = v2[t];
+			min_idx = t;
+		}
+		if (v2[t] >= max2)
+			max2 = v2[t];
+	}
+
+	omp_set_num_threads(nr_thread);
+	ArgMax<GradValue_t> amax;
+	amax.init(-GRADVALUE_MAX);
+	amax = host_reduce(n, amax, [&](int t, ArgMax<GradValue_t> &r) {
+		if (kept(t, filter))
+			r.update(v[t], t);
+	});
+	ArgMin<GradValue_t> amin;
+	amin.init(GRADVALUE_MAX);
+	amin = host_reduce(n, amin, [&](int t, ArgMin<GradValue_t> &r) {
+		if (kept(t, filter))
+			r.update(v2[t], t);
+	});
+	Max<GradValue_t> vmax;
+	vmax.init(-GRADVALUE_MAX);
+	vmax = host_reduce(n, vmax, [&](int t, Max<GradValue_t> &r) {
+		if (kept(t, filter))
+			r.update(v2[t]);
+	});
+
+	check("host ArgMax", n, nr_thread, filter, amax.value, amax.idx, max, max_idx);
+	check("host ArgMin", n, nr_thread, filter, amin.value, amin.idx, min, min_idx);
+	check("host Max", n, nr_thread, filter, vmax.value, 0, max2, 0);
+}
+
+// cuda_find_min_idx and cuda_find_gmax, passed over as CudaSolver::cross_block_reducer does,
+// against ArgMin and ArgMax on the host; filtered elements are (max, -1) as the solver leaves them
+static void check_device(const GradValue_t *v, const GradValue_t *v2, int n, int filter, int block_size)
+{
+	CValue_t *obj = Malloc(CValue_t,n);
+	GradValue_t *gmax = Malloc(GradValue_t,n);
+	GradValue_t *gmax2 = Malloc(GradValue_t,n);
+	int *idx = Malloc(int,n);
+	int *gmax_idx = Malloc(int,n);
+	ArgMin<CValue_t> amin;
+	ArgMax<GradValue_t> amax;
+	Max<GradValue_t> vmax;
+	amin.init(CVALUE_MAX);
+	amax.init(-GRADVALUE_MAX);
+	vmax.init(-GRADVALUE_MAX);
+	for (int t = 0; t < n; t++) {
+		bool k = kept(t, filter);
+		obj[t] = k ? (CValue_t)v2[t] : CVALUE_MAX;
+		idx[t] = k ? t : -1;
+		gmax[t] = k ? v[t] : -GRADVALUE_MAX;
+		gmax_idx[t] = k ? t : -1;
+		gmax2[t] = k ? v2[t] : -GRADVALUE_MAX;
+		amin.update(obj[t], idx[t]);
+		amax.update(gmax[t], gmax_idx[t]);
+		vmax.update(gmax2[t]);
+	}
+
+	CValue_t *d_obj[2];
+	GradValue_t *d_gmax[2], *d_gmax2[2];
+	int *d_idx[2], *d_gmax_idx[2];
+	for (int k = 0; k < 2; k++) {
+		check_cuda_return("fail to allocate", cudaMalloc((void **)&d_obj[k], sizeof(CValue_t)*n));
+		check_cuda_return("fail to allocate", cudaMalloc((void **)&d_gmax[k], sizeof(GradValue_t)*n));
+		check_cuda_return("fail to allocate", cudaMalloc((void **)&d_gmax2[k], sizeof(GradValue_t)*n));
+		check_cuda_return("fail to allocate", cudaMalloc((void **)&d_idx[k], sizeof(int)*n));
+		check_cuda_return("fail to allocate", cudaMalloc((void **)&d_gmax_idx[k], sizeof(int)*n));
+	}
+	check_cuda_return("fail to copy", cudaMemcpy(d_obj[0], obj, sizeof(CValue_t)*n, cudaMemcpyHostToDevice));
+	check_cuda_return("fail to copy", cudaMemcpy(d_gmax[0], gmax, sizeof(GradValue_t)*n, cudaMemcpyHostToDevice));
+	check_cuda_return("fail to copy", cudaMemcpy(d_gmax2[0], gmax2, sizeof(GradValue_t)*n, cudaMemcpyHostToDevice));
+	check_cuda_return("fail to copy", cudaMemcpy(d_idx[0], idx, sizeof(int)*n, cudaMemcpyHostToDevice));
+	check_cuda_return("fail to copy", cudaMemcpy(d_gmax_idx[0], gmax_idx, sizeof(int)*n, cudaMemcpyHostToDevice));
+	check_cuda_return("fail to reset the select status", reset_select_status());
+
+	int in = 0, N = n;
+	while (true) {
+		int reduce_block_size = std::min(N, block_size);
+		int reduce_blocks = (N + 2 * reduce_block_size - 1) / (2 * reduce_block_size);
+		launch_cuda_find_min_idx(reduce_blocks, reduce_block_size, reduce_block_size*(sizeof(CValue_t) + sizeof(int)),
+			d_obj[in], d_idx[in], d_obj[1 - in], d_idx[1 - in], N);
+		find_gmax_param param;
+		param.dh_gmax = d_gmax[in];
+		param.dh_gmax2 = d_gmax2[in];
+		param.dh_gmax_idx = d_gmax_idx[in];
+		param.result_gmax = d_gmax[1 - in];
+		param.result_gmax2 = d_gmax2[1 - in];
+		param.result_gmax_idx = d_gmax_idx[1 - in];
+		param.eps = -GRADVALUE_MAX; // never converged, so every pass reduces
+		launch_cuda_find_gmax(reduce_blocks, reduce_block_size, reduce_block_size*(2 * sizeof(GradValue_t) + sizeof(int)), param, N, false);
+		check_cuda_return("fail in the device reductions", cudaDeviceSynchronize());
+		in = 1 - in;
+		if (reduce_blocks == 1)
+			break;
+		N = reduce_blocks;
+	}
+
+	CValue_t min_value;
+	GradValue_t max_value, max2_value;
+	int min_idx, max_idx, ws_i, ws_j;
+	check_cuda_return("fail to copy", cudaMemcpy(&min_value, d_obj[in], sizeof(CValue_t), cudaMemcpyDeviceToHost));
+	check_cuda_return("fail to copy", cudaMemcpy(&min_idx, d_idx[in], sizeof(int), cudaMemcpyDeviceToHost));
+	check_cuda_return("fail to copy", cudaMemcpy(&max_value, d_gmax[in], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
+	check_cuda_return("fail to copy", cudaMemcpy(&max2_value, d_gmax2[in], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
+	check_cuda_return("fail to copy", cudaMemcpy(&max_idx, d_gmax_idx[in], sizeof(int), cudaMemcpyDeviceToHost));
+	check_cuda_return("fail to get the working set", get_working_set(&ws_i, &ws_j));
+
+	check("device ArgMin", n, 0, filter, min_value, min_idx, amin.value, amin.idx);
+	check("device ArgMax", n, 0, filter, max_value, max_idx, amax.value, amax.idx);
+	check("device Max", n, 0, filter, max2_value, 0, vmax.value, 0);
+	check("device working set", n, 0, filter, 0, ws_i, 0, amax.idx);
+	check("device working set", n, 0, filter, 0, ws_j, 0, amin.idx);
+
+	for (int k = 0; k < 2; k++) {
+		cudaFree(d_obj[k]);
+		cudaFree(d_gmax[k]);
+		cudaFree(d_gmax2[k]);
+		cudaFree(d_idx[k]);
+		cudaFree(d_gmax_idx[k]);
+	}
+	free(obj);
+	free(gmax);
+	free(gmax2);
+	free(idx);
+	free(gmax_idx);
+}
+
+int main(int argc, char **argv)
+{
+	int max_thread = 8, block_size = 256;
+	bool cuda = false;
+	int i;
+	for(i=1;i<argc;i++)
+	{
+		if(argv[i][0] != '-')
+			exit_with_help();
+		if(argv[i][1] == 'C')
+		{
+			cuda = true;
+			continue;
+		}
+		if(++i >= argc)
+			exit_with_help();
+		switch(argv[i-1][1])
+		{
+			case 't': max_thread = atoi(argv[i]); break;
+			case 'b': block_size = atoi(argv[i]); break;
+			default:
+				fprintf(stderr,"Unknown option: -%c\n", argv[i-1][1]);
+				exit_with_help();
+		}
+	}
+	if(max_thread < 1 || block_size < 1)
+		exit_with_help();
+
+	// below 2 * HOST_REDUCE_GRAIN host_reduce does not fork; the others split unevenly
+	const int sizes[] = { 1000, 2 * HOST_REDUCE_GRAIN, 3 * HOST_REDUCE_GRAIN + 1, 8 * HOST_REDUCE_GRAIN + 5, 17 * HOST_REDUCE_GRAIN - 3 };
+	int nr_check = 0;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		int n = sizes[s];
+		GradValue_t *v = Malloc(GradValue_t,n);
+		GradValue_t *v2 = Malloc(GradValue_t,n);
+		for (int nr_thread = 1; nr_thread <= max_thread; nr_thread++) {
+			// few distinct values, so that every range has ties, and the extremes on both
+			// sides of each split of host_reduce, so that the threads tie with each other
+			for (int t = 0; t < n; t++) {
+				v[t] = (GradValue_t)(next_random() % 4);
+				v2[t] = (GradValue_t)(next_random() % 4);
+			}
+			int m = std::min(nr_thread, n / HOST_REDUCE_GRAIN);
+			for (int k = 1; k < m; k++) {
+				int begin = (int)((long long)n * k / m);
+				v[begin - 1] = v[begin] = 8;
+				v2[begin - 1] = v2[begin] = -8;
+			}
+			for (int filter = KEEP_ALL; filter <= KEEP_NONE; filter++) {
+				check_host(v, v2, n, nr_thread, filter);
+				nr_check++;
+				if (cuda && nr_thread == max_thread) {
+					check_device(v, v2, n, filter, block_size);
+					nr_check++;
+				}
+			}
+		}
+		free(v);
+		free(v2);
+	}
+
+	printf("%d checks, %d mismatches\n", nr_check, nr_mismatch);
+	return nr_mismatch ? 1 : 0;
+}
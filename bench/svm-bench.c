@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include "svm.h"
+
+#define Malloc(type,n) (type *)malloc((n)*sizeof(type))
+#define DEFAULT_L 500
+#define NR_FOLD 5
+#define GOLDEN_TOLERANCE 1e-2	// relative, for obj and rho; eps is 1e-3
+#define CHECK_INTERVAL 16	// compared against a check every iteration on the CPU
+
+void print_null(const char *s) {}
+
+void exit_with_help()
+{
+	printf(
+	"Usage: svm-bench [options]\n"
+	"Trains, cross validates and predicts on reproducible synthetic problems for\n"
+	"every svm_type, kernel_type and cache size, and prints the timings as JSON.\n"
+	"On the CPU each case is also trained with -N %d, with and without -E and -J,\n"
+	"and must give the model and iteration count of a check every iteration.\n"
+	"options:\n"
+	"-C : use the cuda solver\n"
+	"-l n : number of rows of each problem (default %d)\n"
+	"-P problem : only run problem (blobs2, blobs4, imbalanced, sparse, checkerboard, friedman1)\n"
+	"-o file : write the JSON results to file instead of stdout\n"
+	"-g file : check nSV, obj and rho of each trained model against a golden file\n"
+	"-w file : write a golden file\n",
+	CHECK_INTERVAL, DEFAULT_L
+	);
+	exit(1);
+}
+
+static double wall_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//
+// deterministic random numbers, so the problems are the same everywhere
+//
+static uint64_t rng_state;
+
+static uint64_t rng_next()
+{
+	uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static double rng_uniform()
+{
+	return (rng_next() >> 11) * (1.0/9007199254740992.0);
+}
+
+static double rng_gauss()
+{
+	double u = rng_uniform(), v = rng_uniform();
+	return sqrt(-2*log(u + 1e-300)) * cos(2*M_PI*v);
+}
+
+//
+// problem generators; each fills prob with l rows of dimension d
+//
+struct problem_def
+{
+	const char *name;
+	int d;
+	int regression;
+	void (*generate)(struct svm_problem *prob, struct svm_node *x_space, int d);
+	int max_nnz;	// nonzeros per row
+};
+
+static struct svm_node *put_dense(struct svm_node *x, const double *v, int d)
+{
+	int k;
+	for(k=0;k<d;k++)
+	{
+		x->index = k+1;
+		x->value = v[k];
+		++x;
+	}
+	x->index = -1;
+	return x+1;
+}
+
+// gaussian clusters; class c is shifted by 2 along axis c (nr_class <= d)
+static void gen_blobs(struct svm_problem *prob, struct svm_node *x_space, int d, int nr_class, double minority)
+{
+	int i, k;
+	double *v = Malloc(double,d);
+	struct svm_node *x = x_space;
+	for(i=0;i<prob->l;i++)
+	{
+		int c;
+		if(minority > 0)
+			c = rng_uniform() < minority ? 1 : 0;
+		else
+			c = (int)(rng_next() % nr_class);
+		for(k=0;k<d;k++)
+			v[k] = 1.5*rng_gauss();
+		v[c] += 2;
+		prob->y[i] = nr_class == 2 ? (c ? 1 : -1) : c+1;
+		prob->x[i] = x;
+		x = put_dense(x,v,d);
+	}
+	free(v);
+}
+
+static void gen_blobs2(struct svm_problem *prob, struct svm_node *x_space, int d) { gen_blobs(prob,x_space,d,2,0); }
+static void gen_blobs4(struct svm_problem *prob, struct svm_node *x_space, int d) { gen_blobs(prob,x_space,d,4,0); }
+static void gen_imbalanced(struct svm_problem *prob, struct svm_node *x_space, int d) { gen_blobs(prob,x_space,d,2,0.1); }
+
+// bag-of-words like rows; the label is the sign of a hidden linear score
+static void gen_sparse(struct svm_problem *prob, struct svm_node *x_space, int d)
+{
+	int i, k, nnz = 30;
+	struct svm_node *x = x_space;
+	for(i=0;i<prob->l;i++)
+	{
+		double score = 0;
+		int index = 0;
+		prob->x[i] = x;
+		for(k=0;k<nnz;k++)
+		{
+			index += 1 + (int)(rng_next() % (2*d/nnz - 1));
+			if(index > d)
+				break;
+			x->index = index;
+			x->value = 1 + (int)(rng_next() % 3);
+			score += (index % 7 < 3 ? 1 : -1) * x->value;
+			++x;
+		}
+		x->index = -1;
+		++x;
+		prob->y[i] = score + 0.5*rng_gauss() > 0 ? 1 : -1;
+	}
+}
+
+// the classic 4x4 checkerboard on [0,4)^2
+static void gen_checkerboard(struct svm_problem *prob, struct svm_node *x_space, int d)
+{
+	int i;
+	double v[2];
+	struct svm_node *x = x_space;
+	for(i=0;i<prob->l;i++)
+	{
+		v[0] = 4*rng_uniform();
+		v[1] = 4*rng_uniform();
+		prob->y[i] = (((int)v[0] + (int)v[1]) % 2) ? 1 : -1;
+		prob->x[i] = x;
+		x = put_dense(x,v,2);
+	}
+}
+
+// Friedman #1: y = 10 sin(pi x1 x2) + 20 (x3 - 0.5)^2 + 10 x4 + 5 x5 + noise, x in [0,1]^10
+static void gen_friedman1(struct svm_problem *prob, struct svm_node *x_space, int d)
+{
+	int i, k;
+	double v[10];
+	struct svm_node *x = x_space;
+	for(i=0;i<prob->l;i++)
+	{
+		for(k=0;k<10;k++)
+			v[k] = rng_uniform();
+		prob->y[i] = 10*sin(M_PI*v[0]*v[1]) + 20*(v[2]-0.5)*(v[2]-0.5) + 10*v[3] + 5*v[4] + rng_gauss();
+		prob->x[i] = x;
+		x = put_dense(x,v,10);
+	}
+}
+
+static struct problem_def problems[] =
+{
+	{ "blobs2", 20, 0, gen_blobs2, 20 },
+	{ "blobs4", 10, 0, gen_blobs4, 10 },
+	{ "imbalanced", 10, 0, gen_imbalanced, 10 },
+	{ "sparse", 5000, 0, gen_sparse, 30 },
+	{ "checkerboard", 2, 0, gen_checkerboard, 2 },
+	{ "friedman1", 10, 1, gen_friedman1, 10 },
+};
+#define NR_PROBLEM (int)(sizeof(problems)/sizeof(problems[0]))
+
+static const char *svm_type_name[] = { "c_svc", "nu_svc", "one_class", "epsilon_svr", "nu_svr" };
+static const char *kernel_type_name[] = { "linear", "polynomial", "rbf", "sigmoid", "precomputed" };
+static const double cache_sizes[] = { 1, 100 };
+#define NR_CACHE_SIZE (int)(sizeof(cache_sizes)/sizeof(cache_sizes[0]))
+
+// rows "0:i 1:K(i,1) ... l:K(i,l)" of the linear kernel, for PRECOMPUTED
+static struct svm_node *make_precomputed(const struct svm_problem *prob, struct svm_problem *pre)
+{
+	int i, j, l = prob->l;
+	struct svm_node *space = Malloc(struct svm_node,(size_t)l*(l+2));
+	pre->l = l;
+	pre->y = prob->y;
+	pre->x = Malloc(struct svm_node *,l);
+	for(i=0;i<l;i++)
+	{
+		struct svm_node *x = &space[(size_t)i*(l+2)];
+		pre->x[i] = x;
+		x[0].index = 0;
+		x[0].value = i+1;
+		for(j=0;j<l;j++)
+		{
+			const struct svm_node *a = prob->x[i], *b = prob->x[j];
+			double sum = 0;
+			while(a->index != -1 && b->index != -1)
+			{
+				if(a->index == b->index)
+				{
+					sum += a->value * b->value;
+					++a; ++b;
+				}
+				else if(a->index > b->index)
+					++b;
+				else
+					++a;
+			}
+			x[j+1].index = j+1;
+			x[j+1].value = sum;
+		}
+		x[l+1].index = -1;
+	}
+	return space;
+}
+
+//
+// per-case results
+//
+struct solve_stats
+{
+	double obj;	// summed over the subproblems of one svm_train, including probability calibration
+	int iter;
+};
+
+static void collect_stats(const struct svm_telemetry *t, void *data)
+{
+	struct solve_stats *s = (struct solve_stats *)data;
+	if(t->event == TELEMETRY_SUMMARY)
+	{
+		// the folds of probability estimates are solved concurrently
+#pragma omp critical(collect_stats)
+		{
+			s->obj += t->obj;
+			s->iter += t->iter;
+		}
+	}
+}
+
+struct golden
+{
+	char key[128];
+	int nSV;
+	double obj, rho;
+};
+
+static struct golden *golden;
+static int nr_golden;
+static int nr_mismatch;
+
+static void read_golden(const char *file)
+{
+	FILE *fp = fopen(file,"r");
+	int max_golden = 64;
+	if(fp == NULL)
+	{
+		fprintf(stderr,"can't open golden file %s\n",file);
+		exit(1);
+	}
+	golden = Malloc(struct golden,max_golden);
+	while(fscanf(fp,"%127s %d %lf %lf",golden[nr_golden].key,&golden[nr_golden].nSV,
+		&golden[nr_golden].obj,&golden[nr_golden].rho) == 4)
+	{
+		if(++nr_golden == max_golden)
+		{
+			max_golden *= 2;
+			golden = (struct golden *)realloc(golden,max_golden*sizeof(struct golden));
+		}
+	}
+	fclose(fp);
+}
+
+static int close_enough(double a, double b)
+{
+	return fabs(a-b) <= GOLDEN_TOLERANCE*fmax(1.0,fmax(fabs(a),fabs(b)));
+}
+
+// returns NULL if the case matches the golden file, otherwise a description
+static const char *check_golden(const char *key, int nSV, double obj, double rho)
+{
+	int i;
+	for(i=0;i<nr_golden;i++)
+		if(strcmp(golden[i].key,key) == 0)
+		{
+			if(abs(nSV - golden[i].nSV) > 2 + golden[i].nSV/50)
+				return "nSV";
+			if(!close_enough(obj,golden[i].obj))
+				return "obj";
+			if(!close_enough(rho,golden[i].rho))
+				return "rho";
+			return NULL;
+		}
+	return "missing";
+}
+
+static int same_model(const struct svm_model *a, const struct svm_model *b)
+{
+	int i, k;
+	if(a->l != b->l || a->nr_class != b->nr_class)
+		return 0;
+	for(k=0;k<a->nr_class*(a->nr_class-1)/2;k++)
+		if(a->rho[k] != b->rho[k])
+			return 0;
+	for(i=0;i<a->l;i++)
+	{
+		if(a->sv_indices[i] != b->sv_indices[i])
+			return 0;
+		for(k=0;k<a->nr_class-1;k++)
+			if(a->sv_coef[k][i] != b->sv_coef[k][i])
+				return 0;
+	}
+	return 1;
+}
+
+// check_interval only defers acting on the stopping condition, so training with it must
+// give exactly the model, objective and iterations of a check every iteration.
+// returns NULL if it does, otherwise a description
+static const char *check_interval_mismatch(const struct svm_problem *train, const struct svm_parameter *base)
+{
+	static char what[64];
+	int stages, fused, m;
+	for(stages=1;stages<=3;stages+=2)
+	for(fused=0;fused<=1;fused++)
+	{
+		struct svm_parameter param = *base;
+		struct solve_stats stats[2];
+		struct svm_model *model[2];
+		const char *mismatch = NULL;
+
+		param.eps_stages = stages;
+		param.fused_select = fused;
+		param.telemetry = &collect_stats;
+		for(m=0;m<2;m++)
+		{
+			param.check_interval = m ? CHECK_INTERVAL : 1;
+			param.telemetry_data = &stats[m];
+			stats[m].obj = 0;
+			stats[m].iter = 0;
+			model[m] = svm_train(train,&param);
+		}
+		if(stats[0].iter != stats[1].iter)
+			mismatch = "iter";
+		else if(stats[0].obj != stats[1].obj)
+			mismatch = "obj";
+		else if(!same_model(model[0],model[1]))
+			mismatch = "model";
+		for(m=0;m<2;m++)
+			svm_free_and_destroy_model(&model[m]);
+		if(mismatch)
+		{
+			sprintf(what,"%s with -E %d -J %d",mismatch,stages,fused);
+			return what;
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct svm_parameter param;
+	FILE *out = stdout, *golden_out = NULL;
+	const char *only = NULL;
+	int l = DEFAULT_L, cuda = 0;
+	int i, p, s, k, c, first = 1;
+
+	for(i=1;i<argc;i++)
+	{
+		if(argv[i][0] != '-') exit_with_help();
+		if(argv[i][1] == 'C')
+		{
+			cuda = 1;
+			continue;
+		}
+		if(++i>=argc)
+			exit_with_help();
+		switch(argv[i-1][1])
+		{
+			case 'l':
+				l = atoi(argv[i]);
+				if(l < 2*NR_FOLD)
+				{
+					fprintf(stderr,"l must be >= %d\n",2*NR_FOLD);
+					exit_with_help();
+				}
+				break;
+			case 'P':
+				only = argv[i];
+				break;
+			case 'o':
+				out = fopen(argv[i],"w");
+				if(out == NULL)
+				{
+					fprintf(stderr,"can't open output file %s\n",argv[i]);
+					exit(1);
+				}
+				break;
+			case 'g':
+				read_golden(argv[i]);
+				break;
+			case 'w':
+				golden_out = fopen(argv[i],"w");
+				if(golden_out == NULL)
+				{
+					fprintf(stderr,"can't open golden file %s\n",argv[i]);
+					exit(1);
+				}
+				break;
+			default:
+				fprintf(stderr,"Unknown option: -%c\n", argv[i-1][1]);
+				exit_with_help();
+		}
+	}
+
+	svm_set_print_string_function(&print_null);
+
+	fprintf(out,"[\n");
+	for(p=0;p<NR_PROBLEM;p++)
+	{
+		struct problem_def *def = &problems[p];
+		struct svm_problem prob, pre;
+		struct svm_node *x_space, *pre_space;
+		double *target, prob_estimates[16];	// 16 >= number of classes of any problem
+
+		if(only && strcmp(only,def->name) != 0)
+			continue;
+
+		rng_state = 1 + p;
+		prob.l = l;
+		prob.y = Malloc(double,l);
+		prob.x = Malloc(struct svm_node *,l);
+		x_space = Malloc(struct svm_node,(size_t)l*(def->max_nnz+1));
+		def->generate(&prob,x_space,def->d);
+		pre_space = make_precomputed(&prob,&pre);
+		target = Malloc(double,l);
+
+		for(s=C_SVC;s<=NU_SVR;s++)
+		{
+			if((s == EPSILON_SVR || s == NU_SVR) != def->regression)
+				continue;
+			for(k=LINEAR;k<=PRECOMPUTED;k++)
+			for(c=0;c<NR_CACHE_SIZE+1;c++)
+			{
+				// the extra pass trains a probability model with the default cache
+				int probability = (c == NR_CACHE_SIZE);
+				const struct svm_problem *train = (k == PRECOMPUTED ? &pre : &prob);
+				struct svm_model *model;
+				struct solve_stats stats;
+				const char *error;
+				char key[128];
+				double t, train_time, cv_time, predict_time, metric = 0;
+				int j;
+
+				if(probability && (s == ONE_CLASS || k != RBF))
+					continue;
+
+				memset(&param,0,sizeof(param));
+				param.cuda_flag = cuda;
+				param.svm_type = s;
+				param.kernel_type = k;
+				param.degree = 3;
+				param.gamma = 1.0/def->d;
+				param.coef0 = 0;
+				param.nu = 0.1;
+				param.cache_size = probability ? cache_sizes[NR_CACHE_SIZE-1] : cache_sizes[c];
+				param.C = 1;
+				param.eps = 1e-3;
+				param.p = 0.1;
+				param.shrinking = cuda ? 0 : 1;
+				param.probability = probability;
+				param.cache_precision = CACHE_FLOAT;
+				param.seed = 1;
+				param.telemetry = &collect_stats;
+				param.telemetry_data = &stats;
+
+				sprintf(key,"%s/l%d/%s/%s/%gMB%s",def->name,l,svm_type_name[s],kernel_type_name[k],
+					param.cache_size,probability ? "/prob" : "");
+
+				if(!first)
+					fprintf(out,",\n");
+				first = 0;
+
+				error = svm_check_parameter(train,&param);
+				if(error)
+				{
+					fprintf(out,"  {\"case\": \"%s\", \"error\": \"%s\"}",key,error);
+					continue;
+				}
+
+				stats.obj = 0;
+				stats.iter = 0;
+				t = wall_time();
+				model = svm_train(train,&param);
+				train_time = wall_time() - t;
+
+				t = wall_time();
+				for(j=0;j<train->l;j++)
+					target[j] = probability ? svm_predict_probability(model,train->x[j],prob_estimates) : svm_predict(model,train->x[j]);
+				predict_time = wall_time() - t;
+				for(j=0;j<train->l;j++)
+					if(def->regression)
+						metric += (target[j]-train->y[j])*(target[j]-train->y[j])/train->l;
+					else if(target[j] == train->y[j])
+						metric += 1.0/train->l;
+
+				// cross validation reports through the same callback
+				param.telemetry = NULL;
+				t = wall_time();
+				svm_cross_validation(train,&param,NR_FOLD,target);
+				cv_time = wall_time() - t;
+
+				fprintf(out,"  {\"case\": \"%s\", \"problem\": \"%s\", \"l\": %d, \"d\": %d, "
+					"\"svm_type\": \"%s\", \"kernel_type\": \"%s\", \"cache_mb\": %g, \"probability\": %d, "
+					"\"train_s\": %.6f, \"cv_s\": %.6f, \"predict_s\": %.6f, "
+					"\"iter\": %d, \"nSV\": %d, \"obj\": %.10g, \"rho\": %.10g",
+					key,def->name,l,def->d,svm_type_name[s],kernel_type_name[k],param.cache_size,probability,
+					train_time,cv_time,predict_time,stats.iter,model->l,stats.obj,model->rho[0]);
+				if(s != ONE_CLASS)
+					fprintf(out,", \"%s\": %.6g",def->regression ? "train_mse" : "train_accuracy",metric);
+
+				if(golden_out)
+					fprintf(golden_out,"%s %d %.10g %.10g\n",key,model->l,stats.obj,model->rho[0]);
+				if(golden)
+				{
+					const char *mismatch = check_golden(key,model->l,stats.obj,model->rho[0]);
+					fprintf(out,", \"golden\": \"%s\"",mismatch ? mismatch : "ok");
+					if(mismatch)
+					{
+						fprintf(stderr,"golden mismatch (%s): %s\n",mismatch,key);
+						++nr_mismatch;
+					}
+				}
+				if(!cuda && c == 0)
+				{
+					const char *mismatch = check_interval_mismatch(train,&param);
+					fprintf(out,", \"check_interval\": \"%s\"",mismatch ? mismatch : "ok");
+					if(mismatch)
+					{
+						fprintf(stderr,"check_interval mismatch (%s): %s\n",mismatch,key);
+						++nr_mismatch;
+					}
+				}
+				fprintf(out,"}");
+				fflush(out);
+				svm_free_and_destroy_model(&model);
+			}
+		}
+
+		free(target);
+		free(pre.x);
+		free(pre_space);
+		free(x_space);
+		free(prob.x);
+		free(prob.y);
+	}
+	fprintf(out,"\n]\n");
+
+	if(out != stdout)
+		fclose(out);
+	if(golden_out)
+		fclose(golden_out);
+	free(golden);
+	return nr_mismatch > 0;
+}
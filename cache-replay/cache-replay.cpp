@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "svm.h"
+#include "lru_policy.h"
+
+#define Malloc(type,n) (type *)malloc((n)*sizeof(type))
+#define MAX_SIZES 16
+
+void exit_with_help()
+{
+	printf(
+	"Usage: cache-replay [options] trace_file\n"
+	"Replays a working-set trace through the device LRU column cache policy on\n"
+	"the host, and reports its hits and evictions.  The trace is either written by\n"
+	"svm-train -X, or text with one \"i j\" pair per line.  Traces of svm-train -X\n"
+	"are also replayed through the CPU Cache and gradient update of each subproblem.\n"
+	"options:\n"
+	"-l l : number of rows of a text trace (default 1 + largest index in the trace)\n"
+	"-m cachesize : cache size in MB, as given to svm-train -m; may be repeated\n"
+	"	(default 100, or the size the trace of svm-train -X was recorded with)\n"
+	"-n columns : number of device cached columns instead of -m; may be repeated\n"
+	"-Q precision : element type of the CPU Cache, as svm-train -Q (default: as recorded)\n"
+	"-z : truncate the CPU Cache columns to the active set on shrinking, as svm-train -z 1\n"
+	"-c : check the invariants of the device cache index after each step\n"
+	"-v : print the hit or miss and the evicted column of each device cache access\n"
+	);
+	exit(1);
+}
+
+static int *trace;	// i and j of each step
+static int nr_step;
+
+// a text trace of "i j" pairs
+static void read_text_trace(FILE *fp, int *max_index)
+{
+	int max_step = 1024, i, j;
+	trace = Malloc(int,2*max_step);
+	nr_step = 0;
+	*max_index = -1;
+	while(fscanf(fp,"%d %d",&i,&j) == 2)
+	{
+		if(i < 0 || j < 0)
+		{
+			fprintf(stderr,"Wrong input format at step %d\n",nr_step+1);
+			exit(1);
+		}
+		if(nr_step == max_step)
+		{
+			max_step *= 2;
+			trace = (int *)realloc(trace,2*max_step*sizeof(int));
+		}
+		trace[2*nr_step] = i;
+		trace[2*nr_step+1] = j;
+		*max_index = std::max(*max_index,std::max(i,j));
+		++nr_step;
+	}
+}
+
+// the iterations of a subproblem traced by svm-train -X, with the indices
+// permuted by shrinking mapped back to rows of the subproblem as the device
+// cache (which does not shrink) sees them; returns the number of swaps
+static int unshrink_trace(const svm_trace_header *header, const svm_trace_record *record)
+{
+	int *row = Malloc(int,header->l);
+	int nr_swap = 0;
+	for(int k=0;k<header->l;k++)
+		row[k] = k;
+	trace = Malloc(int,2*(header->nr_record+1));
+	nr_step = 0;
+	for(int r=0;r<header->nr_record;r++)
+	{
+		if(record[r].active_size < 0)
+		{
+			std::swap(row[record[r].i],row[record[r].j]);
+			++nr_swap;
+			continue;
+		}
+		trace[2*nr_step] = row[record[r].i];
+		trace[2*nr_step+1] = row[record[r].j];
+		++nr_step;
+	}
+	free(row);
+	return nr_swap;
+}
+
+// number of cached columns CudaSolver::setup_LRU_cache gets for cache_size MB
+static int device_cache_columns(double cache_size, int l)
+{
+	int space = static_cast<int>(cache_size * (1 << 20));
+	int num_elements = space / sizeof(CValue_t);
+	return std::max(5, (num_elements + l-1) / l);
+}
+
+struct ReplayStats {
+	long hits[2], misses[2], evictions;
+};
+
+// one access of the STAGE_I/STAGE_J protocol, as cache_get_Q does it on the device
+static void get_Q(LRUCachePolicy &cache, int col, StageArea_t stage_area, ReplayStats &stats, bool verbose)
+{
+	int n = cache.find(col);
+	if(n != NO_NODE)
+	{
+		cache.stage_hit(n,stage_area);
+		++stats.hits[stage_area];
+		if(verbose)
+			printf(" %c %d hit",stage_area == STAGE_AREA_I ? 'i' : 'j',col);
+	}
+	else
+	{
+		n = cache.victim(col,stage_area);
+		int evicted = cache.stage_miss(n,col,stage_area);
+		++stats.misses[stage_area];
+		if(evicted != -1)
+			++stats.evictions;
+		if(verbose)
+		{
+			printf(" %c %d miss",stage_area == STAGE_AREA_I ? 'i' : 'j',col);
+			if(evicted != -1)
+				printf(" evict %d",evicted);
+		}
+	}
+}
+
+static void replay(int l, int nr_column, bool check, bool verbose)
+{
+	// the index only carries the policy state here; no column data is stored
+	LRUCacheArrays index(nr_column,l);
+	LRUCachePolicy cache = index.policy(&index.index[0],NULL,0);
+
+	ReplayStats stats;
+	memset(&stats,0,sizeof(stats));
+	for(int s=0;s<nr_step;s++)
+	{
+		int i = trace[2*s], j = trace[2*s+1];
+		if(verbose)
+			printf("%d:",s);
+		get_Q(cache,i,STAGE_AREA_I,stats,verbose);
+		get_Q(cache,j,STAGE_AREA_J,stats,verbose);
+		cache.commit(i,STAGE_AREA_I);
+		cache.commit(j,STAGE_AREA_J);
+		if(verbose)
+			printf("\n");
+		const char *error = check ? check_cache_index(cache,l) : NULL;
+		if(error)
+		{
+			fprintf(stderr,"step %d: %s\n",s,error);
+			exit(1);
+		}
+	}
+
+	long hits = stats.hits[0] + stats.hits[1];
+	long total = hits + stats.misses[0] + stats.misses[1];
+	printf("columns = %d, steps = %d, hits = %ld (i %ld, j %ld), misses = %ld (i %ld, j %ld), evictions = %ld, hit rate = %g%%\n",
+		nr_column, nr_step, hits, stats.hits[0], stats.hits[1],
+		total - hits, stats.misses[0], stats.misses[1], stats.evictions,
+		total > 0 ? 100.0 * hits / total : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	double cache_size[MAX_SIZES];
+	int nr_column[2*MAX_SIZES];
+	int nr_cache_size = 0, nr_nr_column = 0;
+	int l = 0, max_index;
+	int cache_precision = -1;
+	bool check = false, compact = false, verbose = false;
+	int i;
+
+	for(i=1;i<argc;i++)
+	{
+		if(argv[i][0] != '-') break;
+		if(argv[i][1] == 'c')
+		{
+			check = true;
+			continue;
+		}
+		if(argv[i][1] == 'z')
+		{
+			compact = true;
+			continue;
+		}
+		if(argv[i][1] == 'v')
+		{
+			verbose = true;
+			continue;
+		}
+		if(++i >= argc)
+			exit_with_help();
+		switch(argv[i-1][1])
+		{
+			case 'l':
+				l = atoi(argv[i]);
+				break;
+			case 'm':
+				if(nr_cache_size == MAX_SIZES)
+					exit_with_help();
+				cache_size[nr_cache_size++] = atof(argv[i]);
+				break;
+			case 'n':
+				if(nr_nr_column == MAX_SIZES || atoi(argv[i]) < 2)
+					exit_with_help();
+				nr_column[nr_nr_column++] = atoi(argv[i]);
+				break;
+			case 'Q':
+				cache_precision = atoi(argv[i]);
+				break;
+			default:
+				fprintf(stderr,"Unknown option: -%c\n", argv[i-1][1]);
+				exit_with_help();
+		}
+	}
+	if(i != argc-1)
+		exit_with_help();
+
+	FILE *fp = fopen(argv[i],"rb");
+	if(fp == NULL)
+	{
+		fprintf(stderr,"can't open trace file %s\n",argv[i]);
+		exit(1);
+	}
+	svm_trace_header header;
+	if(fread(&header,sizeof(header),1,fp) != 1 || header.magic != SVM_TRACE_MAGIC)
+	{
+		rewind(fp);
+		read_text_trace(fp,&max_index);
+		if(l == 0)
+			l = max_index + 1;
+		if(max_index >= l)
+		{
+			fprintf(stderr,"trace index %d out of range for -l %d\n",max_index,l);
+			exit(1);
+		}
+		if(nr_cache_size == 0 && nr_nr_column == 0)
+			cache_size[nr_cache_size++] = 100;
+
+		for(int k=0;k<nr_cache_size;k++)
+			nr_column[nr_nr_column++] = device_cache_columns(cache_size[k],l);
+		for(int k=0;k<nr_nr_column;k++)
+			replay(l,nr_column[k],check,verbose);
+		free(trace);
+		fclose(fp);
+		return 0;
+	}
+
+	int nr_fixed_column = nr_nr_column;
+	for(int subproblem=0;;subproblem++)
+	{
+		svm_trace_record *record = Malloc(svm_trace_record,header.nr_record);
+		if(header.magic != SVM_TRACE_MAGIC ||
+			fread(record,sizeof(svm_trace_record),header.nr_record,fp) != (size_t)header.nr_record)
+		{
+			fprintf(stderr,"truncated trace file %s\n",argv[i]);
+			exit(1);
+		}
+		int nr_swap = unshrink_trace(&header,record);
+		printf("subproblem %d: l = %d, iterations = %d, swaps = %d%s\n",
+			subproblem,header.l,nr_step,nr_swap,header.cuda ? " (device)" : "");
+
+		int nr_size = nr_cache_size;
+		double *size = cache_size;
+		if(nr_cache_size == 0)
+		{
+			nr_size = 1;
+			size = &header.cache_size;
+		}
+
+		// device policy
+		nr_nr_column = nr_fixed_column;
+		for(int k=0;k<nr_size;k++)
+			nr_column[nr_nr_column++] = device_cache_columns(size[k],header.l);
+		for(int k=0;k<nr_nr_column;k++)
+		{
+			printf("  device LRU: ");
+			replay(header.l,nr_column[k],check,verbose);
+		}
+
+		// CPU Cache
+		for(int k=0;k<nr_size;k++)
+		{
+			svm_replay_stats stats;
+			svm_replay_trace(&header,record,size[k],
+				cache_precision >= 0 ? cache_precision : header.cache_precision,compact,&stats);
+			long total = stats.hits + stats.misses;
+			printf("  CPU Cache: %g MB, hits = %ld, misses = %ld, hit rate = %g%%, filled = %g, cache %g s, update %g s\n",
+				size[k],stats.hits,stats.misses,total > 0 ? 100.0 * stats.hits / total : 0.0,
+				stats.filled,stats.cache_time,stats.update_time);
+		}
+
+		free(trace);
+		free(record);
+		if(fread(&header,sizeof(header),1,fp) != 1)
+			break;
+	}
+	fclose(fp);
+	return 0;
+}
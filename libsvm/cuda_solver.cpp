@@ -21,7 +21,14 @@
 #include "sparse_bit_vector.h"
 #include <memory>
 
-CudaSolver *cudaSolver;
+thread_local CudaSolver *cudaSolver; // per thread, see svm_binary_svc_probability()
+thread_local CudaSession *cudaSession;
+
+MemoryPool<CudaAllocator> &device_memory_pool()
+{
+	static MemoryPool<CudaAllocator> pool;
+	return pool;
+}
 
 /****** MinIdxReducer *********/
 class CudaSolver::MinIdxReducer
@@ -63,12 +70,12 @@ private:
 	GradValue_t *input_array1, *output_array1; // Gmax
 	GradValue_t *input_array2, *output_array2; // Gmax2
 	int *input_idx, *output_idx; // Gmax_idx
-	GradValue_t Gmax, Gmax2;
+	GradValue_t eps;
 	bool debug;
 
 public:
-	GmaxReducer(GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, GradValue_t *result_gmax, GradValue_t *result_gmax2, int *result_gmax_idx, bool debug=false)
-		: input_array1(dh_gmax), input_array2(dh_gmax2), input_idx(dh_gmax_idx), output_array1(result_gmax), output_array2(result_gmax2), output_idx(result_gmax_idx), debug(debug)
+	GmaxReducer(GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, GradValue_t *result_gmax, GradValue_t *result_gmax2, int *result_gmax_idx, GradValue_t eps, bool debug=false)
+		: input_array1(dh_gmax), input_array2(dh_gmax2), input_idx(dh_gmax_idx), output_array1(result_gmax), output_array2(result_gmax2), output_idx(result_gmax_idx), eps(eps), debug(debug)
 	{}
 
 	void compute(size_t reduce_blocks, size_t reduce_block_size, int N)
@@ -81,6 +88,7 @@ public:
 		param.result_gmax = output_array1;
 		param.result_gmax2 = output_array2;
 		param.result_gmax_idx = output_idx;
+		param.eps = eps;
 		logtrace("TRACE: GmaxReducer::compute: share_mem_size=%d, reduce_blocks=%d, reduce_block_size=%d, N=%d\n",
 			share_mem_size, reduce_blocks, reduce_block_size, N);
 		launch_cuda_find_gmax(reduce_blocks, reduce_block_size, share_mem_size, param, N, debug);
@@ -96,21 +104,9 @@ public:
 
 	int process_output()
 	{
-		/* int Gmax_idx = -1;
-		   check_cuda_return("fail to copy output_idx from device",
-		   cudaMemcpy(&Gmax_idx, &output_idx[0], sizeof(int), cudaMemcpyDeviceToHost)); */
-		check_cuda_return("fail to copy output_array1 from device",
-			cudaMemcpy(&Gmax, &output_array1[0], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
-		check_cuda_return("fail to copy output_array2 from device",
-			cudaMemcpy(&Gmax2, &output_array2[0], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
+		// the last pass leaves Gmax, Gmax2 and the stopping test in d_select on the device
 		return -1;
 	}
-
-	void get_gmax_values(GradValue_t &ret_Gmax, GradValue_t &ret_Gmax2)
-	{
-		ret_Gmax = Gmax;
-		ret_Gmax2 = Gmax2;
-	}
 };
 
 /****** Initialization methods ***********/
@@ -166,10 +162,10 @@ void CudaSolver::init_memory_arrays(int l)
 		std::cout << "Gradient vector stored as:          " << typeid(GradValue_t).name() << std::endl;
 	}
 
-	result_idx.reset(new int[num_blocks]);
-	result_obj_diff.reset(new CValue_t[num_blocks]);
-	result_gmax.reset(new GradValue_t[num_blocks]);
-	result_gmax2.reset(new GradValue_t[num_blocks]);
+	result_idx = make_unique_host_array<int>(num_blocks);
+	result_obj_diff = make_unique_host_array<CValue_t>(num_blocks);
+	result_gmax = make_unique_host_array<GradValue_t>(num_blocks);
+	result_gmax2 = make_unique_host_array<GradValue_t>(num_blocks);
 
 	init_obj_diff_space(l);
 	init_gmax_space(l);
@@ -207,6 +203,20 @@ void CudaSolver::setup_solver(const SChar_t *y, double *G, double *alpha, char *
 		check_cuda_return("fail to copy to device for dh_G", err);
 	}
 
+	/** mixed precision support for the gradient vector */
+	if (compensated_gradient) {
+		dh_G_comp = make_unique_cuda_array<GradValue_t>(active_size);
+		err = cudaMemset(&dh_G_comp[0], 0, sizeof(GradValue_t) * active_size);
+		check_cuda_return("fail to clear dh_G_comp", err);
+	}
+	if (gradient_refresh > 0) {
+		h_G_init = make_unique_host_array<double>(active_size);
+		memcpy(&h_G_init[0], G, sizeof(double) * active_size);
+		dh_G_refresh = make_unique_cuda_array<double>(active_size);
+	}
+	err = update_gradient_shadow(compensated_gradient ? &dh_G_comp[0] : NULL, gradient_refresh > 0 ? &dh_G_refresh[0] : NULL);
+	check_cuda_return("fail to setup gradient shadow arrays", err);
+
 	dh_alpha = make_unique_cuda_array<GradValue_t>(active_size);
 	{
 		std::unique_ptr<GradValue_t[]> h_alpha(new GradValue_t[active_size]);
@@ -256,6 +266,9 @@ void CudaSolver::setup_solver(const SChar_t *y, double *G, double *alpha, char *
 
 	setup_LRU_cache(active_size);
 
+	check_cuda_return("fail to reset the select status", reset_select_status());
+	idle_iter = 0;
+
 #if DEBUG_CHECK
 	show_memory_usage(mem_size);
 #endif
@@ -287,9 +300,9 @@ void CudaSolver::setup_rbf_variables(int l)
 	dbgprintf(true, "CudaSolver::setup_rbf_variables: elapsed time = %f\n", (float)(clock() - now) / CLOCKS_PER_SEC); // DEBUG
 }
 
-void CudaSolver::show_memory_usage(const int &total_space)
+void CudaSolver::show_memory_usage(const long long &total_space)
 {
-	printf("Total space allocated on device:	%d\n", total_space);
+	printf("Total space allocated on device:	%lld\n", total_space);
 	int devNum;
 	cudaGetDevice(&devNum);
 	cudaDeviceProp devProp;
@@ -309,14 +322,13 @@ void CudaSolver::setup_LRU_cache(int active_size)
 	num_columns = std::max(5, num_columns); // cache at least 5 columns
 	space = num_columns * active_size; // re-compute the number of bytes owe want to cache
 	dh_column_space = make_unique_cuda_array<CValue_t>(space);
-	dh_columns = make_unique_cuda_array<CacheNode*>(active_size);
-	{
-		std::unique_ptr<CacheNode*[]> h_columns(new CacheNode*[active_size]);
-		for (int i = 0; i < active_size; i++)
-			h_columns[i] = NULL;
-		cudaMemcpy(&dh_columns[0], &h_columns[0], active_size * sizeof(CacheNode*), cudaMemcpyHostToDevice);
-	}
-	setup_device_LRU_cache(&dh_columns[0], &dh_column_space[0], space, active_size);
+
+	// the cache index is built on the host and copied in one piece
+	LRUCacheArrays h_index(num_columns, active_size);
+	dh_cache_index = make_unique_cuda_array<int>(h_index.index.size());
+	cudaError_t err = cudaMemcpy(&dh_cache_index[0], &h_index.index[0], h_index.index.size() * sizeof(int), cudaMemcpyHostToDevice);
+	check_cuda_return("fail to copy cache index to device", err);
+	setup_device_LRU_cache(h_index.policy(&dh_cache_index[0], &dh_column_space[0], active_size));
 }
 
 /**
@@ -330,6 +342,22 @@ void CudaSolver::load_problem_parameters(const svm_problem &prob, const svm_para
 
 	cache_size = param.cache_size;
 
+#if !USE_BITVECTOR_FORMAT
+	/** the rows are already on the device if they are in the session */
+	if (cudaSession) {
+		std::unique_ptr<int[]> h_x(new int[l]);
+		if (cudaSession->find_rows(prob, &h_x[0])) {
+			dh_x = make_unique_cuda_array<int>(l);
+			err = cudaMemcpy(&dh_x[0], &h_x[0], sizeof(int) * l, cudaMemcpyHostToDevice);
+			check_cuda_return("fail to copy to device for dh_x", err);
+
+			err = update_param_constants(param, &dh_x[0], cudaSession->space(), cudaSession->space_size(), prob.l);
+			check_cuda_return("fail to setup parameter constants", err);
+			return;
+		}
+	}
+#endif
+
 	/** allocate space for support vectors */
 #if USE_BITVECTOR_FORMAT
 	int bitvector_size;
@@ -495,8 +523,83 @@ void CudaSolver::load_problem_parameters(const svm_problem &prob, const svm_para
 #endif
 }
 
+#define MAX_TEXTURE_ELEMENTS	(1 << 27) // of a 1D texture bound to linear memory
+
+CudaSession::CudaSession(const svm_problem &prob) : dh_space(NULL), elements(0)
+{
+#if !USE_BITVECTOR_FORMAT
+	for (int i = 0; i < prob.l; ++i) {
+		if (row_offset.count(prob.x[i]))
+			continue; // a row may be given more than once
+		row_offset[prob.x[i]] = static_cast<int>(elements);
+		for (const svm_node *tmp = prob.x[i]; tmp->index != -1; ++tmp)
+			++elements;
+		++elements; // the row terminator
+	}
+	if (elements > MAX_TEXTURE_ELEMENTS) {
+		// the subproblems are uploaded one by one, as they were before sessions
+		row_offset.clear();
+		return;
+	}
+
+	dbgprintf(true, "CudaSession: %lu elements need to be moved to device\n", elements);
+	dh_space = static_cast<cuda_svm_node *>(device_memory_pool().acquire(elements * sizeof(cuda_svm_node)));
+	if (dh_space == NULL)
+		check_cuda_return("cudaMalloc error", cudaErrorMemoryAllocation);
+
+	// in the order of row_offset, a chunk at a time as in load_problem_parameters()
+	size_t transfer_chunk = std::min((size_t)TRANSFER_CHUNK_SIZE, elements);
+	std::unique_ptr<cuda_svm_node[]> x_space(new cuda_svm_node[transfer_chunk]);
+	size_t next_loc = 0, j = 0, loc = 0;
+	cudaError_t err;
+	for (int i = 0; i < prob.l; ++i) {
+		if (row_offset[prob.x[i]] != static_cast<int>(loc))
+			continue; // uploaded already
+		const svm_node *tmp = prob.x[i];
+		for (;; ++tmp) {
+			x_space[j].x = static_cast<float>(tmp->value);
+			x_space[j].y = static_cast<float>(tmp->index); // -1 for the row terminator
+			++j;
+			++loc;
+			if (j == transfer_chunk) {
+				err = cudaMemcpy(&dh_space[next_loc], &x_space[0], j * sizeof(cuda_svm_node), cudaMemcpyHostToDevice);
+				check_cuda_return("fail to copy to device for session dh_space", err);
+				next_loc += j;
+				j = 0;
+			}
+			if (tmp->index == -1)
+				break;
+		}
+	}
+	if (j > 0) {
+		err = cudaMemcpy(&dh_space[next_loc], &x_space[0], j * sizeof(cuda_svm_node), cudaMemcpyHostToDevice);
+		check_cuda_return("fail to copy to device for session dh_space", err);
+	}
+#endif
+}
+
+CudaSession::~CudaSession()
+{
+	device_memory_pool().release(dh_space);
+}
+
+bool CudaSession::find_rows(const svm_problem &prob, int *offset) const
+{
+	if (dh_space == NULL)
+		return false;
+	for (int i = 0; i < prob.l; ++i) {
+		std::unordered_map<const svm_node *, int>::const_iterator it = row_offset.find(prob.x[i]);
+		if (it == row_offset.end())
+			return false;
+		offset[i] = it->second;
+	}
+	return true;
+}
+
 CudaSolver::CudaSolver(const svm_problem &prob, const svm_parameter &param, bool quiet_mode)
-	: l(prob.l), eps(param.eps), kernel_type(param.kernel_type), svm_type(param.svm_type), mem_size(0), quiet_mode(quiet_mode)
+	: l(prob.l), eps(param.eps), kernel_type(param.kernel_type), svm_type(param.svm_type), mem_size(0), quiet_mode(quiet_mode),
+	gradient_refresh(param.gradient_refresh), compensated_gradient(param.compensated_gradient), kkt_gap(GRADVALUE_MAX),
+	fuse_gmax(param.fused_select != 0), gmax_ready(false), idle_iter(0)
 {
 	int deviceNum;
 	cudaGetDevice(&deviceNum);
@@ -524,8 +627,9 @@ CudaSolver::CudaSolver(const svm_problem &prob, const svm_parameter &param, bool
 
 CudaSolver::~CudaSolver()
 {
+	// the device arrays go back to device_memory_pool() for the next subproblem,
+	// so the device is not reset here
 	unbind_texture();
-	cudaDeviceReset();
 }
 
 /****** Compute methods **********/
@@ -543,17 +647,17 @@ void CudaSolver::update_alpha_status()
 	check_cuda_kernel_launch("fail in cuda_update_alpha_status");
 }
 
-void CudaSolver::select_working_set_j(GradValue_t Gmax, int l)
+void CudaSolver::select_working_set_j(int l)
 {
 	logtrace("TRACE: select_working_set_j: num_blocks=%d block_size=%d\n", num_blocks, block_size);
 
 	if (svm_type == EPSILON_SVR) { 
 		// for SVR we only need to compute for half the working set, because the other half is symmetric
 		int nblocks = (num_blocks + 1) / 2;
-		launch_cuda_compute_obj_diff_SVR(nblocks, block_size, Gmax, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l/2);
+		launch_cuda_compute_obj_diff_SVR(nblocks, block_size, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l/2);
 	}
 	else {
-		launch_cuda_compute_obj_diff(num_blocks, block_size, Gmax, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l);
+		launch_cuda_compute_obj_diff(num_blocks, block_size, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l);
 	}
 	check_cuda_kernel_launch("fail in cuda_compute_obj_diff");
 
@@ -567,45 +671,104 @@ void CudaSolver::select_working_set_j(GradValue_t Gmax, int l)
 }
 
 
-int CudaSolver::select_working_set(int &out_i, int &out_j, int l)
+int CudaSolver::select_working_set(int &out_i, int &out_j, int l, bool check)
 {
 	logtrace("TRACE: select_working_set: l = %d\n", l);
-	GradValue_t Gmax = -GRADVALUE_MAX; // -INF;
-	GradValue_t Gmax2 = -GRADVALUE_MAX; // -INF;
 
-	launch_cuda_prep_gmax (num_blocks, block_size, &dh_gmax[0], &dh_gmax2[0], &dh_gmax_idx[0], l);
-	check_cuda_kernel_launch("fail in cuda_prep_gmax");
+	if (!gmax_ready) {
+		launch_cuda_prep_gmax (num_blocks, block_size, &dh_gmax[0], &dh_gmax2[0], &dh_gmax_idx[0], l);
+		check_cuda_kernel_launch("fail in cuda_prep_gmax");
+	}
+	gmax_ready = false;
 
 	logtrace("TRACE: select_working_set: done preparing for finding gmax\n");
 
 	GmaxReducer func(&dh_gmax[0], &dh_gmax2[0], &dh_gmax_idx[0], &dh_result_gmax[0], 
-		&dh_result_gmax2[0], &dh_result_gmax_idx[0]);
+		&dh_result_gmax2[0], &dh_result_gmax_idx[0], eps);
 
 	cross_block_reducer(block_size, func, l);
 
-	func.get_gmax_values(Gmax, Gmax2);
-
-	if (Gmax + Gmax2 < eps) {
-		return 1;
-	}
+	// the stopping test is done on the device, which skips the step once it holds
+	select_working_set_j(l);
 
-	select_working_set_j(Gmax, l);
+	return check ? check_convergence() : 0;
+}
 
-	return 0;
+int CudaSolver::check_convergence()
+{
+	device_select_status status;
+	check_cuda_return("fail to get the select status", get_select_status(&status));
+	kkt_gap = status.kkt_gap;
+	if (!status.converged)
+		return 0;
+
+	// start over for the next stage of eps
+	idle_iter = status.idle;
+	check_cuda_return("fail to reset the select status", reset_select_status());
+	gmax_ready = false;
+	return 1;
 }
 
 void CudaSolver::update_gradient(int l)
 {
 	logtrace("TRACE: update_gradient: l = %d\n", l);
+	// with fuse_gmax the same sweep prepares the Gmax candidates of the next select_working_set()
+	GradValue_t *gmax = fuse_gmax ? &dh_gmax[0] : NULL;
+	GradValue_t *gmax2 = fuse_gmax ? &dh_gmax2[0] : NULL;
+	int *gmax_idx = fuse_gmax ? &dh_gmax_idx[0] : NULL;
 	if (svm_type == EPSILON_SVR || svm_type == NU_SVR) { 
 		// for SVR we only need to compute half the working set, because the other half is symmetric
 		int nblocks = (num_blocks + 1) / 2;
-		launch_cuda_update_gradient_SVR(nblocks, block_size, l / 2);
+		launch_cuda_update_gradient_SVR(nblocks, block_size, gmax, gmax2, gmax_idx, l / 2);
 	}
 	else {
-		launch_cuda_update_gradient(num_blocks, block_size, l);
+		launch_cuda_update_gradient(num_blocks, block_size, gmax, gmax2, gmax_idx, l);
 	}
 	check_cuda_kernel_launch("fail in cuda_update_gradient");
+	gmax_ready = fuse_gmax;
+}
+
+void CudaSolver::refresh_gradient(int l)
+{
+	logtrace("TRACE: refresh_gradient: l = %d\n", l);
+	gmax_ready = false;
+	cudaError_t err = cudaMemcpy(&dh_G_refresh[0], &h_G_init[0], sizeof(double) * l, cudaMemcpyHostToDevice);
+	check_cuda_return("fail to copy to device for dh_G_refresh", err);
+
+	// NOTE: as in setup_solver(), the sum is split over several launches so devices do not time out
+	const int step = 4096;
+	for (int start = 0; start < l; start += step) {
+		launch_cuda_refresh_gradient(num_blocks, block_size, start, step, l);
+		check_cuda_kernel_launch("fail in cuda_refresh_gradient");
+	}
+
+	launch_cuda_commit_gradient(num_blocks, block_size, l);
+	check_cuda_kernel_launch("fail in cuda_commit_gradient");
+}
+
+double CudaSolver::get_objective(const double *p, int l)
+{
+	std::unique_ptr<GradValue_t[]> h_G(new GradValue_t[l]);
+	std::unique_ptr<GradValue_t[]> h_alpha(new GradValue_t[l]);
+	cudaError_t err = cudaMemcpy(&h_G[0], &dh_G[0], sizeof(GradValue_t) * l, cudaMemcpyDeviceToHost);
+	check_cuda_return("fail to copy from device dh_G", err);
+	err = cudaMemcpy(&h_alpha[0], &dh_alpha[0], sizeof(GradValue_t) * l, cudaMemcpyDeviceToHost);
+	check_cuda_return("fail to copy from device dh_alpha", err);
+
+	double obj = 0;
+	for (int i = 0; i < l; ++i)
+		obj += h_alpha[i] * (h_G[i] + p[i]);
+	return obj / 2;
+}
+
+double CudaSolver::get_cache_hit_rate() const
+{
+	return get_device_cache_hit_rate();
+}
+
+void CudaSolver::fetch_working_set(int &i, int &j)
+{
+	check_cuda_return("fail to copy the working set from device", get_working_set(&i, &j));
 }
 
 void CudaSolver::fetch_vectors(double *G, double *alpha, char *alpha_status, int l)
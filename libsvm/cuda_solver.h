@@ -23,10 +23,54 @@
 #include <iostream>
 #include <memory>
 #include <ctime>
+#include <unordered_map>
 
 #include "svm_defs.h"
+#include "memory_pool.h"
 #include <cstring> // for memset()
 
+/**
+ * Allocator of device memory for MemoryPool
+ **/
+struct CudaAllocator {
+	static void *allocate(size_t bytes) {
+		void *p;
+		return cudaMalloc(&p, bytes) == cudaSuccess ? p : NULL;
+	}
+	static void release(void *p) { cudaFree(p); }
+};
+
+// pool of device memory; its buffers outlive the CudaSolver of one subproblem
+MemoryPool<CudaAllocator> &device_memory_pool();
+
+/**
+ * The rows of the problem given to svm_train, uploaded to the device once and shared by
+ * the CudaSolvers of all its subproblems, which refer to the rows by their offsets.
+ * Rows are identified by their svm_node pointers, as the subproblems of svm_train point
+ * into the rows of its problem.
+ **/
+class CudaSession
+{
+public:
+	CudaSession(const svm_problem &prob);
+	~CudaSession();
+
+	/**
+	 * @param prob		a subproblem
+	 * @param offset	returns the offset in space() of each row of prob
+	 * @return false if a row of prob is not in the session
+	 **/
+	bool find_rows(const svm_problem &prob, int *offset) const;
+
+	cuda_svm_node *space() const { return dh_space; }
+	size_t space_size() const { return elements * sizeof(cuda_svm_node); } // bytes
+
+private:
+	cuda_svm_node *dh_space; // NULL if the problem was not uploaded
+	size_t elements;
+	std::unordered_map<const svm_node *, int> row_offset;
+};
+
 class CudaSolver
 {
 protected:
@@ -68,13 +112,14 @@ protected:
 
 	/**
 	Smart pointers for CUDA arrays.  Their semantics are similar to C++11 std::unique_ptr.
+	The arrays come from, and go back to, device_memory_pool().
 	*/
 	struct CudaDeleter
 	{
 		void operator()(void *p)
 		{
 			if (p != nullptr) {
-				cudaFree(p);
+				device_memory_pool().release(p);
 			} 
 		}
 	};
@@ -112,9 +157,9 @@ protected:
 	template <typename T>
 	CudaArray_t<T> make_unique_cuda_array(size_t size)
 	{
-		void *ptr;
-		cudaError_t err = cudaMalloc(&ptr, size*sizeof(T));
-		check_cuda_return("cudaMalloc error", err);
+		void *ptr = device_memory_pool().acquire(size*sizeof(T));
+		if (ptr == NULL)
+			check_cuda_return("cudaMalloc error", cudaErrorMemoryAllocation);
 		mem_size += size*sizeof(T);
 		return CudaArray_t<T>(static_cast<T *>(ptr));
 	}
@@ -131,11 +176,18 @@ protected:
 	int kernel_type;
 	int svm_type;
 	int l; // #SVs
-	int mem_size; // amount of cuda memory allocated
+	long long mem_size; // amount of cuda memory allocated
 	int startup_time;
 
 	bool quiet_mode;
 
+	int gradient_refresh; // > 0 if refresh_gradient() is used
+	int compensated_gradient; // accumulate gradient updates with Kahan compensation
+	GradValue_t kkt_gap; // maximal violation read by the last check_convergence()
+	bool fuse_gmax; // update_gradient() also prepares dh_gmax, dh_gmax2 and dh_gmax_idx (param.fused_select)
+	bool gmax_ready; // dh_gmax, dh_gmax2 and dh_gmax_idx hold the candidates for the current gradient
+	int idle_iter; // steps skipped on the device after the convergence found by check_convergence()
+
 	/**
 	CUDA device memory arrays
 	*/
@@ -159,11 +211,14 @@ protected:
 	CudaArray_t<CValue_t> dh_x_square; 
 	CudaArray_t<GradValue_t> dh_alpha; 
 	CudaArray_t<char> dh_alpha_status; 	
+	CudaArray_t<GradValue_t> dh_G_comp; // Kahan compensation of dh_G
+	CudaArray_t<double> dh_G_refresh; // double precision accumulator for refresh_gradient()
+	std::unique_ptr<double[], HostPoolDeleter> h_G_init; // the linear term, which refresh_gradient() starts from
 
 	/********** LRU CACHE ***********/
 	double cache_size; // cache size as set by parameter
 	CudaArray_t<CValue_t> dh_column_space;
-	CudaArray_t<CacheNode*> dh_columns;
+	CudaArray_t<int> dh_cache_index; // device copy of LRUCacheArrays::index
 
 #if USE_BITVECTOR_FORMAT
 	/**** Sparse Vector representation ****/
@@ -176,10 +231,10 @@ protected:
 	/**
 	The following arrays are required by the reducers
 	*/
-	std::unique_ptr<int[]> result_idx;
-	std::unique_ptr<CValue_t[]> result_obj_diff;
-	std::unique_ptr<GradValue_t[]> result_gmax;
-	std::unique_ptr<GradValue_t[]> result_gmax2;
+	std::unique_ptr<int[], HostPoolDeleter> result_idx;
+	std::unique_ptr<CValue_t[], HostPoolDeleter> result_obj_diff;
+	std::unique_ptr<GradValue_t[], HostPoolDeleter> result_gmax;
+	std::unique_ptr<GradValue_t[], HostPoolDeleter> result_gmax2;
 
 	enum { LOWER_BOUND = 0, UPPER_BOUND = 1, FREE = 2 };
 
@@ -205,7 +260,7 @@ private:
 	/**
 	Shows amount of memory allocated on cuda device
 	*/
-	void show_memory_usage(const int &total_space);
+	void show_memory_usage(const long long &total_space);
 
 	/**
 	Loads the SVM problem parameters onto cuda device
@@ -215,7 +270,7 @@ private:
 	/**
 	Used by select_working_set() to find the j index
 	*/
-	void select_working_set_j(GradValue_t Gmax, int l);
+	void select_working_set_j(int l);
 
 	/**
 	Utility function for finding the launch parameters for N instances
@@ -232,18 +287,51 @@ public:
 
 	void setup_rbf_variables(int l); // for RBF kernel only
 
-	// return 1 if already optimal, return 0 otherwise
-	virtual int select_working_set(int &out_i, int &out_j, int l);
+	/**
+	Queues the selection of the working set on the device without waiting for it.
+	The device checks the stopping condition itself and, once it holds, turns the
+	following steps into no-ops, so the host need only ask every few iterations.
+	@param check	wait for the selection and check the stopping condition
+	@return 1 if check and already optimal, return 0 otherwise
+	*/
+	virtual int select_working_set(int &out_i, int &out_j, int l, bool check=true);
+
+	/**
+	Reads the stopping condition from the device and clears it if it holds
+	@return 1 if optimal, 0 otherwise
+	*/
+	int check_convergence();
+
+	// steps skipped between the convergence and the check_convergence() that reported it
+	int get_idle_iterations() const { return idle_iter; }
 
 	void update_gradient(int l);
 
+	// recompute the gradient vector from scratch in double precision
+	void refresh_gradient(int l);
+
+	double get_kkt_gap() const { return kkt_gap; }
+
+	// stopping tolerance of select_working_set(), for staged eps
+	void set_eps(double eps) { this->eps = eps; }
+
+	// 0.5 * alpha^T (G + p) of the current solution; copies G and alpha from the device
+	double get_objective(const double *p, int l);
+
+	// hit rate of the device column cache, < 0 unless COLLECT_CACHE_STATS is on
+	double get_cache_hit_rate() const;
+
 	void compute_alpha();
 
 	void update_alpha_status();
 
 	void fetch_vectors(double *G, double *alpha, char *alpha_status, int l);
+
+	// i and j of the last select_working_set(); waits for the device
+	void fetch_working_set(int &i, int &j);
 };
 
-extern CudaSolver *cudaSolver;
+extern thread_local CudaSolver *cudaSolver;
+extern thread_local CudaSession *cudaSession; // of the outermost svm_train on this thread, or NULL
 
 #endif
@@ -29,20 +29,20 @@ private:
 	GradValue_t *input_array4, *output_array4; // Gmaxn2
 	int *input_idx1, *output_idx1; // Gmaxp_idx
 	int *input_idx2, *output_idx2; // Gmaxn_idx
-	GradValue_t Gmaxp, Gmaxn;
-	GradValue_t Gmaxp2, Gmaxn2;
+	GradValue_t eps;
 
 public:
 	NuGmaxReducer(GradValue_t *dh_gmaxp, GradValue_t *dh_gmaxn, GradValue_t *dh_gmaxp2, GradValue_t *dh_gmaxn2, 
 		int *dh_gmaxp_idx, int *dh_gmaxn_idx,
 		GradValue_t *result_gmaxp, GradValue_t *result_gmaxn, GradValue_t *result_gmaxp2, GradValue_t *result_gmaxn2,
-		int *result_gmaxp_idx, int *result_gmaxn_idx)
+		int *result_gmaxp_idx, int *result_gmaxn_idx, GradValue_t eps)
 		: input_array1(dh_gmaxp), output_array1(result_gmaxp), /* Gmaxp */
 		input_array2(dh_gmaxn), output_array2(result_gmaxn), /* Gmaxn */
 		input_array3(dh_gmaxp2), output_array3(result_gmaxp2), /* Gmaxp2 */
 		input_array4(dh_gmaxn2), output_array4(result_gmaxn2), /* Gmaxn2 */
 		input_idx1(dh_gmaxp_idx), output_idx1(result_gmaxp_idx), /* Gmaxp_idx */
-		input_idx2(dh_gmaxn_idx), output_idx2(result_gmaxn_idx) /* Gmaxn_idx */
+		input_idx2(dh_gmaxn_idx), output_idx2(result_gmaxn_idx), /* Gmaxn_idx */
+		eps(eps)
 	{}
 
 	void compute(size_t reduce_blocks, size_t reduce_block_size, int N) {
@@ -63,6 +63,7 @@ public:
 		param.result_gmaxn2 = output_array4;
 		param.result_gmaxp_idx = output_idx1;
 		param.result_gmaxn_idx = output_idx2;
+		param.eps = eps;
 
 		launch_cuda_find_nu_gmax(reduce_blocks, reduce_block_size, share_mem_size, param, N);
 	}
@@ -77,26 +78,9 @@ public:
 	}
 
 	int process_output() {
-		/* check_cuda_return("fail to copy output_idx from device",
-		cudaMemcpy(&Gmax_idx, &output_idx[0], sizeof(int), cudaMemcpyDeviceToHost)); */ // Gmax_idx should be in the first position now
-		check_cuda_return("fail to copy output_array1 from device",
-			cudaMemcpy(&Gmaxp, &output_array1[0], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
-		check_cuda_return("fail to copy output_array2 from device",
-			cudaMemcpy(&Gmaxn, &output_array2[0], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
-		check_cuda_return("fail to copy output_array1 from device",
-			cudaMemcpy(&Gmaxp2, &output_array3[0], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
-		check_cuda_return("fail to copy output_array2 from device",
-			cudaMemcpy(&Gmaxn2, &output_array4[0], sizeof(GradValue_t), cudaMemcpyDeviceToHost));
+		// the last pass leaves Gmaxp, Gmaxn, Gmaxp2, Gmaxn2 and the stopping test in d_select on the device
 		return 0;
 	}
-
-	void get_gmax_values(GradValue_t &ret_Gmaxp, GradValue_t &ret_Gmaxn, GradValue_t &ret_Gmaxp2, GradValue_t &ret_Gmaxn2)
-	{
-		ret_Gmaxp = Gmaxp;
-		ret_Gmaxn = Gmaxn;
-		ret_Gmaxp2 = Gmaxp2;
-		ret_Gmaxn2 = Gmaxn2;
-	}
 };
 
 /********* NuMinIdxReducer **************/
@@ -150,15 +134,15 @@ void CudaSolverNU::init_gmax_space(int l)
 	return;
 }
 
-void CudaSolverNU::select_working_set_j(GradValue_t Gmaxp, GradValue_t Gmaxn, int l)
+void CudaSolverNU::select_working_set_j(int l)
 {
 	if (svm_type == NU_SVR) {
 		// for SVR we only need to compute for half the working set, because the other half is symmetric
 		int nblocks = (num_blocks + 1) / 2;
-		launch_cuda_compute_nu_obj_diff_SVR(nblocks, block_size, Gmaxp, Gmaxn, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l/2);
+		launch_cuda_compute_nu_obj_diff_SVR(nblocks, block_size, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l/2);
 	}
 	else {
-		launch_cuda_compute_nu_obj_diff(num_blocks, block_size, Gmaxp, Gmaxn, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l);
+		launch_cuda_compute_nu_obj_diff(num_blocks, block_size, &dh_obj_diff_array[0], &dh_obj_diff_idx[0], l);
 	}
 
 	NuMinIdxReducer func(&dh_obj_diff_array[0], &dh_obj_diff_idx[0], &dh_result_obj_diff[0], &dh_result_idx[0]);
@@ -168,30 +152,19 @@ void CudaSolverNU::select_working_set_j(GradValue_t Gmaxp, GradValue_t Gmaxn, in
 	return ;
 }
 
-int CudaSolverNU::select_working_set(int &out_i, int &out_j, int l)
+int CudaSolverNU::select_working_set(int &out_i, int &out_j, int l, bool check)
 {
-	GradValue_t Gmaxp = -GRADVALUE_MAX;
-	GradValue_t Gmaxp2 = -GRADVALUE_MAX;
-
-	GradValue_t Gmaxn = -GRADVALUE_MAX;
-	GradValue_t Gmaxn2 = -GRADVALUE_MAX;
-
 	launch_cuda_prep_nu_gmax(num_blocks, block_size, &dh_gmaxp[0], &dh_gmaxn[0], &dh_gmaxp2[0], &dh_gmaxn2[0],
 		&dh_gmaxp_idx[0], &dh_gmaxn_idx[0], l);
 
 	NuGmaxReducer func(&dh_gmaxp[0], &dh_gmaxn[0], &dh_gmaxp2[0], &dh_gmaxn2[0],
 		&dh_gmaxp_idx[0], &dh_gmaxn_idx[0],
 		&dh_result_gmaxp[0], &dh_result_gmaxn[0], &dh_result_gmaxp2[0], &dh_result_gmaxn2[0], 
-		&dh_result_gmaxp_idx[0], &dh_result_gmaxn_idx[0]);
+		&dh_result_gmaxp_idx[0], &dh_result_gmaxn_idx[0], eps);
 	
 	cross_block_reducer(block_size, func, l);
 
-	func.get_gmax_values(Gmaxp, Gmaxn, Gmaxp2, Gmaxn2);
-
-	if (std::max(Gmaxp + Gmaxp2, Gmaxn + Gmaxn2) < eps)
-		return 1;
-
-	select_working_set_j(Gmaxp, Gmaxn, l);
+	select_working_set_j(l);
 
-	return 0;
+	return check ? check_convergence() : 0;
 }
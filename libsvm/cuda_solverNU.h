@@ -47,13 +47,15 @@ private:
 
 	class NuGmaxReducer; // class object used for cross_block_reducer template function
 
-	void select_working_set_j(GradValue_t Gmaxp, GradValue_t Gmaxn, int l); 
+	void select_working_set_j(int l); 
 
 public:
 	CudaSolverNU(const svm_problem &prob, const svm_parameter &param, bool quiet_mode=true) :
-		CudaSolver(prob, param, quiet_mode) {}
+		CudaSolver(prob, param, quiet_mode) {
+		fuse_gmax = false; // the nu selection prepares its own Gmaxp/Gmaxn candidates
+	}
 
-	virtual int select_working_set(int &out_i, int &out_j, int l); // overrides the version in CudaSolver
+	virtual int select_working_set(int &out_i, int &out_j, int l, bool check=true); // overrides the version in CudaSolver
 };
 
 #endif
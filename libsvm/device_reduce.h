@@ -19,6 +19,7 @@
 #ifndef _CUDA_TEMPLATES_H_
 #define _CUDA_TEMPLATES_H_
 #include "svm_defs.h"
+#include "reduce.h"
 
 extern __shared__ char ss[];
 
@@ -53,7 +54,7 @@ public:
 		s_obj_diff[tid] = obj_diff_array[g_idx];
 		s_indx[tid] = obj_diff_indx[g_idx];
 		if (p_idx < N) {
-			if (obj_diff_array[p_idx] <= obj_diff_array[g_idx]) {
+			if (ArgMin<CValue_t>::prefer(obj_diff_array[p_idx], obj_diff_indx[p_idx], s_obj_diff[tid], s_indx[tid])) {
 				s_obj_diff[tid] = obj_diff_array[p_idx];
 				s_indx[tid] = obj_diff_indx[p_idx];
 			}
@@ -62,8 +63,7 @@ public:
 
 	__device__ void reduce(const int &tid1, const int &tid2)
 	{
-		if (s_obj_diff[tid2] <  s_obj_diff[tid1] || 
-			(s_obj_diff[tid2] == s_obj_diff[tid1] && s_indx[tid2] > s_indx[tid1])) {
+		if (ArgMin<CValue_t>::prefer(s_obj_diff[tid2], s_indx[tid2], s_obj_diff[tid1], s_indx[tid1])) {
 				s_obj_diff[tid1] = s_obj_diff[tid2];
 				s_indx[tid1] = s_indx[tid2];
 		}
@@ -114,25 +114,23 @@ public:
 		s_gmax2[tid] = dh_gmax2[g_idx];
 
 		if (p_idx < N) {
-			if (s_gmax[tid] < dh_gmax[p_idx] ||
-				(s_gmax[tid] == dh_gmax[p_idx] && s_gmax_idx[tid] < dh_gmax_idx[p_idx])) {
+			if (ArgMax<GradValue_t>::prefer(dh_gmax[p_idx], dh_gmax_idx[p_idx], s_gmax[tid], s_gmax_idx[tid])) {
 					s_gmax[tid] = dh_gmax[p_idx];
 					s_gmax_idx[tid] = dh_gmax_idx[p_idx];
 			}
 
-			if (s_gmax2[tid] < dh_gmax2[p_idx])
+			if (Max<GradValue_t>::prefer(dh_gmax2[p_idx], s_gmax2[tid]))
 				s_gmax2[tid] = dh_gmax2[p_idx];
 		}
 	}
 
 	__device__ void reduce(const int &tid1, const int &tid2)
 	{
-		if (s_gmax[tid2] >  s_gmax[tid1] || 
-			(s_gmax[tid2] == s_gmax[tid1] && s_gmax_idx[tid2] > s_gmax_idx[tid1])) {
+		if (ArgMax<GradValue_t>::prefer(s_gmax[tid2], s_gmax_idx[tid2], s_gmax[tid1], s_gmax_idx[tid1])) {
 				s_gmax[tid1] = s_gmax[tid2];
 				s_gmax_idx[tid1] = s_gmax_idx[tid2];
 		}
-		if (s_gmax2[tid2] >  s_gmax2[tid1]) {
+		if (Max<GradValue_t>::prefer(s_gmax2[tid2], s_gmax2[tid1])) {
 			s_gmax2[tid1] = s_gmax2[tid2];
 		}
 	}
@@ -147,6 +145,11 @@ public:
 	__device__ int return_idx() {
 		return s_gmax_idx[0];
 	}
+
+	__device__ void return_values(GradValue_t &gmax, GradValue_t &gmax2) {
+		gmax = s_gmax[0];
+		gmax2 = s_gmax2[0];
+	}
 };
 
 class D_NuGmaxReducer
@@ -189,8 +192,8 @@ public:
 
 	__device__ void block_out_of_range(const int &bid)
 	{
-		result_gmaxp[0] = result_gmaxn[0] = result_gmaxp2[0] = result_gmaxn2[0] = -GRADVALUE_MAX;
-		result_gmaxp_idx[0] = result_gmaxn_idx[0] = -1;
+		result_gmaxp[bid] = result_gmaxn[bid] = result_gmaxp2[bid] = result_gmaxn2[bid] = -GRADVALUE_MAX;
+		result_gmaxp_idx[bid] = result_gmaxn_idx[bid] = -1;
 	}
 
 	__device__ void load_shared_memory(const int &tid, const int &g_idx, const int &p_idx, const int &N)
@@ -203,38 +206,34 @@ public:
 		s_gmaxn2[tid] = dh_gmaxn2[g_idx];
 
 		if (p_idx < N) {
-			if (s_gmaxp[tid] < dh_gmaxp[p_idx] ||
-				(s_gmaxp[tid] == dh_gmaxp[p_idx] && s_gmaxp_idx[tid] < dh_gmaxp_idx[p_idx])) {
+			if (ArgMax<GradValue_t>::prefer(dh_gmaxp[p_idx], dh_gmaxp_idx[p_idx], s_gmaxp[tid], s_gmaxp_idx[tid])) {
 				s_gmaxp[tid] = dh_gmaxp[p_idx];
 				s_gmaxp_idx[tid] = dh_gmaxp_idx[p_idx];
 			}
-			if (s_gmaxn[tid] < dh_gmaxn[p_idx] ||
-				(s_gmaxn[tid] == dh_gmaxn[p_idx] && s_gmaxn_idx[tid] < dh_gmaxn_idx[p_idx])) {
+			if (ArgMax<GradValue_t>::prefer(dh_gmaxn[p_idx], dh_gmaxn_idx[p_idx], s_gmaxn[tid], s_gmaxn_idx[tid])) {
 				s_gmaxn[tid] = dh_gmaxn[p_idx];
 				s_gmaxn_idx[tid] = dh_gmaxn_idx[p_idx];
 			}
-			if (s_gmaxp2[tid] < dh_gmaxp2[p_idx])
+			if (Max<GradValue_t>::prefer(dh_gmaxp2[p_idx], s_gmaxp2[tid]))
 				s_gmaxp2[tid] = dh_gmaxp2[p_idx];
-			if (s_gmaxn2[tid] < dh_gmaxn2[p_idx])
+			if (Max<GradValue_t>::prefer(dh_gmaxn2[p_idx], s_gmaxn2[tid]))
 				s_gmaxn2[tid] = dh_gmaxn2[p_idx];
 		}
 	}
 
 	__device__ void reduce(const int &tid1, const int &tid2)
 	{
-		if (s_gmaxp[tid2] >  s_gmaxp[tid1] ||
-			(s_gmaxp[tid2] == s_gmaxp[tid1] && s_gmaxp_idx[tid2] > s_gmaxp_idx[tid1])) {
+		if (ArgMax<GradValue_t>::prefer(s_gmaxp[tid2], s_gmaxp_idx[tid2], s_gmaxp[tid1], s_gmaxp_idx[tid1])) {
 			s_gmaxp[tid1] = s_gmaxp[tid2];
 			s_gmaxp_idx[tid1] = s_gmaxp_idx[tid2];
 		}
-		if (s_gmaxn[tid2] >  s_gmaxn[tid1] ||
-			(s_gmaxn[tid2] == s_gmaxn[tid1] && s_gmaxn_idx[tid2] > s_gmaxn_idx[tid1])) {
+		if (ArgMax<GradValue_t>::prefer(s_gmaxn[tid2], s_gmaxn_idx[tid2], s_gmaxn[tid1], s_gmaxn_idx[tid1])) {
 			s_gmaxn[tid1] = s_gmaxn[tid2];
 			s_gmaxn_idx[tid1] = s_gmaxn_idx[tid2];
 		}
-		if (s_gmaxp2[tid2] > s_gmaxp2[tid1])
+		if (Max<GradValue_t>::prefer(s_gmaxp2[tid2], s_gmaxp2[tid1]))
 			s_gmaxp2[tid1] = s_gmaxp2[tid2];
-		if (s_gmaxn2[tid2] > s_gmaxn2[tid1])
+		if (Max<GradValue_t>::prefer(s_gmaxn2[tid2], s_gmaxn2[tid1]))
 			s_gmaxn2[tid1] = s_gmaxn2[tid2];
 	}
 
@@ -251,6 +250,13 @@ public:
 		gmaxp_idx = s_gmaxp_idx[0];
 		gmaxn_idx = s_gmaxn_idx[0];
 	}
+
+	__device__ void return_values(GradValue_t &gmaxp, GradValue_t &gmaxn, GradValue_t &gmaxp2, GradValue_t &gmaxn2) {
+		gmaxp = s_gmaxp[0];
+		gmaxn = s_gmaxn[0];
+		gmaxp2 = s_gmaxp2[0];
+		gmaxn2 = s_gmaxn2[0];
+	}
 };
 
 __device__ GradValue_t device_compute_gradient(int i, int j);
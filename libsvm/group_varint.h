@@ -0,0 +1,236 @@
+/*
+** Copyright 2014 Edward Walker
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http ://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+
+** Description: Group-varint delta coding of the feature indices of sparse rows
+** for the CPU kernel, with a bulk decoder (SSSE3 when the compiler targets it)
+** and a sparse dot product over decoded blocks
+*/
+#ifndef _GROUP_VARINT_H_
+#define _GROUP_VARINT_H_
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include "svm.h"
+
+#define GV_BLOCK	64	// indices decoded at a time, a multiple of 4
+#define GV_PADDING	16	// bytes after the encoded data that the decoders may read
+
+/**
+ * Rows of svm_nodes with the indices stored as gaps to the previous index, in
+ * groups of four: one control byte holding (byte length - 1) of each gap in two
+ * bits, then the four gaps in little-endian order, 1 to 4 bytes each.  The last
+ * group of a row is padded with zero gaps.  The values are kept as doubles so
+ * that dot products are the same as on svm_nodes.
+ **/
+class GroupVarintRows {
+public:
+	struct Row {
+		const uint8_t *index; // encoded gaps
+		const double *value;
+		int nnz;
+	};
+
+	GroupVarintRows(int l, const svm_node * const *x) {
+		size_t nr_byte = 0, nnz = 0;
+		for (int i = 0; i < l; i++) {
+			int prev = 0, n = 0;
+			for (const svm_node *p = x[i]; p->index != -1; p++, n++) {
+				if (n % 4 == 0)
+					++nr_byte; // control byte
+				nr_byte += length(p->index - prev);
+				prev = p->index;
+			}
+			nr_byte += (4 - n % 4) % 4; // zero gaps of the last group
+			nnz += n;
+		}
+
+		bytes = (uint8_t *)malloc(nr_byte + GV_PADDING);
+		values = (double *)malloc(nnz * sizeof(double));
+		rows = (Row *)malloc(l * sizeof(Row));
+		if (bytes == NULL || values == NULL || rows == NULL)
+			throw std::runtime_error("fail to allocate group varint rows");
+		memset(bytes + nr_byte, 0, GV_PADDING);
+		encoded_size = nr_byte;
+
+		uint8_t *b = bytes;
+		double *v = values;
+		for (int i = 0; i < l; i++) {
+			const svm_node *p = x[i];
+			rows[i].index = b;
+			rows[i].value = v;
+			int prev = 0, n = 0;
+			while (p->index != -1) {
+				uint8_t *control = b++;
+				*control = 0;
+				for (int k = 0; k < 4; k++) {
+					uint32_t gap = 0;
+					if (p->index != -1) {
+						gap = (uint32_t)(p->index - prev);
+						prev = p->index;
+						*v++ = p->value;
+						++p;
+						++n;
+					}
+					int len = length(gap);
+					*control |= (len - 1) << (2 * k);
+					for (int c = 0; c < len; c++)
+						*b++ = (uint8_t)(gap >> (8 * c));
+				}
+			}
+			rows[i].nnz = n;
+		}
+	}
+
+	~GroupVarintRows() {
+		free(bytes);
+		free(values);
+		free(rows);
+	}
+
+	const Row &row(int i) const { return rows[i]; }
+
+	void swap_index(int i, int j) {
+		Row t = rows[i];
+		rows[i] = rows[j];
+		rows[j] = t;
+	}
+
+	// bytes of encoded indices, against sizeof(svm_node) per index before
+	size_t index_bytes() const { return encoded_size; }
+
+	/**
+	 * Decodes one group of four indices
+	 * @param p		control byte of the group; moved to the next group
+	 * @param prev	last index decoded; updated
+	 * @param out	the four indices
+	 **/
+	static void decode_group(const uint8_t *&p, int &prev, int *out) {
+		const Tables &t = tables();
+		uint8_t control = *p++;
+#ifdef __SSSE3__
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p),
+			_mm_loadu_si128((const __m128i *)t.shuffle[control]));
+		// prefix sum of the gaps
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+		v = _mm_add_epi32(v, _mm_set1_epi32(prev));
+		_mm_storeu_si128((__m128i *)out, v);
+		prev = out[3];
+#else
+		const uint8_t *q = p;
+		for (int k = 0; k < 4; k++) {
+			int len = ((control >> (2 * k)) & 3) + 1;
+			uint32_t gap;
+			memcpy(&gap, q, sizeof(gap)); // little endian; GV_PADDING covers the overread
+			gap &= 0xffffffffu >> (8 * (4 - len));
+			q += len;
+			prev += (int)gap;
+			out[k] = prev;
+		}
+#endif
+		p += t.length[control];
+	}
+
+	/**
+	 * Sparse dot product, merging the indices a block of GV_BLOCK at a time.
+	 * The merge within blocks is branch-free; the products of matching indices
+	 * are accumulated in the same order as Kernel::dot.
+	 **/
+	static double dot(const Row &a, const Row &b) {
+		Decoder da(a), db(b);
+		double sum = 0;
+		if (!da.refill() || !db.refill())
+			return sum;
+		int i = 0, j = 0;
+		for (;;) {
+			while (i < da.n && j < db.n) {
+				int xa = da.idx[i], xb = db.idx[j];
+				double prod = da.value[i] * db.value[j];
+				sum += xa == xb ? prod : 0.0;
+				i += xa <= xb;
+				j += xb <= xa;
+			}
+			if (i == da.n) {
+				if (!da.refill())
+					break;
+				i = 0;
+			}
+			if (j == db.n) {
+				if (!db.refill())
+					break;
+				j = 0;
+			}
+		}
+		return sum;
+	}
+
+private:
+	uint8_t *bytes;
+	double *values;
+	Row *rows;
+	size_t encoded_size;
+
+	static int length(uint32_t gap) {
+		return gap < (1u << 8) ? 1 : gap < (1u << 16) ? 2 : gap < (1u << 24) ? 3 : 4;
+	}
+
+	struct Tables {
+		uint8_t length[256];	// data bytes of a group
+		uint8_t shuffle[256][16];	// pshufb masks spreading a group to four 32-bit gaps
+		Tables() {
+			for (int c = 0; c < 256; c++) {
+				int offset = 0;
+				for (int k = 0; k < 4; k++) {
+					int len = ((c >> (2 * k)) & 3) + 1;
+					for (int byte = 0; byte < 4; byte++)
+						shuffle[c][4 * k + byte] = byte < len ? (uint8_t)(offset + byte) : 0x80;
+					offset += len;
+				}
+				length[c] = (uint8_t)offset;
+			}
+		}
+	};
+	static const Tables &tables() {
+		static const Tables t; // initialized once, thread-safe in C++11
+		return t;
+	}
+
+	// decodes a row GV_BLOCK indices at a time
+	struct Decoder {
+		const uint8_t *p;
+		const double *value; // values of the indices in idx
+		int left; // indices not decoded yet
+		int prev;
+		int n; // indices in idx
+		int idx[GV_BLOCK];
+
+		Decoder(const Row &r) : p(r.index), value(r.value), left(r.nnz), prev(0), n(0) {}
+
+		bool refill() {
+			value += n;
+			n = left < GV_BLOCK ? left : GV_BLOCK;
+			for (int k = 0; k < n; k += 4)
+				decode_group(p, prev, &idx[k]);
+			left -= n;
+			return n > 0;
+		}
+	};
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+** Copyright 2014 Edward Walker
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http ://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+
+** Description: Replacement policy and index of the LRU column cache, shared by
+** the device cache (device_cache.h) and host tools that replay working-set traces
+*/
+#ifndef _SVM_LRU_POLICY_H_
+#define _SVM_LRU_POLICY_H_
+#include <stdio.h>
+#include <vector>
+#include "svm_defs.h"
+
+enum StageArea_t {STAGE_AREA_I = 0, STAGE_AREA_J = 1};
+
+/**
+States
+------
+   ->STAGE_I: two scenerios - a cache node could be found (hit) for column I, or a cache node could be reclaimed for caching column I
+  |     |
+  |     V
+  |  STAGE_J: two scenerios - a cache node cound be found (hit) for column J, or a cache node, not used in STAGE_I, be reclaimed for cacheing column J
+  |     |
+  |     V
+   --COMMIT: move the staged columns I and J to the front of the LRU list
+*/
+enum CacheStates_t {STAGE_I = 0, STAGE_J = 1, COMMIT = 3};
+
+#define NO_NODE	(-1)
+
+/**
+ * The cache index: cache node n holds the column buffer column_space[n*col_size, (n+1)*col_size)
+ * and is described by element n of flat arrays, linked into a doubly-linked LRU list by
+ * node number.  The arrays are built on the host (LRUCacheArrays) and copied to the device
+ * as they are, so no node is allocated from the device heap.
+ * It has no constructor so that it can be a __device__ variable.
+ * The methods only decide and record; the device serializes the updating ones on one thread.
+ **/
+struct LRUCachePolicy {
+	int *next; // next node in LRU list
+	int *prev; // previous node in LRU list
+	int *col_idx;   // column that this buffer currently represents
+	int *stage_idx; // column that this buffer is being modifed for
+	int *used; // cache node is currently being read
+	int *columns; // cache node of each column, NO_NODE if not cached
+	CValue_t *column_space;
+	int col_size;
+	int head; // node at the front of the list
+	int tail; // node at the end of the list
+	int size; // number of nodes we have in the list
+	int staging_area[2];
+
+	HOST_DEVICE CValue_t *column(int n) const {
+		return &column_space[(size_t)n * col_size];
+	}
+
+	HOST_DEVICE void push_front(int n) {
+		if (head == NO_NODE) {
+			head = tail = n;
+		}
+		else {
+			next[n] = head;
+			prev[head] = n;
+			head = n; // n is the new head
+		}
+		++size;
+	}
+
+	HOST_DEVICE void remove(int n) {
+		// modify head and tail
+		if (size == 1) {
+			head = tail = NO_NODE; // empty the list
+		}
+		else if (n == head) {
+			head = next[n]; // move the head to the next position
+		}
+		else if (n == tail) {
+			tail = prev[n]; // move the tail to the previous positon
+		}
+
+		// modify the links of the double-linked list
+		if (next[n] != NO_NODE) { // modify the node in front of n (n->next)
+			prev[next[n]] = prev[n];
+		}
+		if (prev[n] != NO_NODE) { // modify the node behind of n (n->prev)
+			next[prev[n]] = next[n];
+		}
+
+		// reset the node links
+		next[n] = NO_NODE;
+		prev[n] = NO_NODE;
+
+		--size;
+	}
+
+	HOST_DEVICE void dump() const {
+		printf("LRU: ");
+		for (int n = head; n != NO_NODE; n = next[n]) {
+			printf("%d ", col_idx[n]);
+		}
+		printf("\n");
+	}
+
+	/**
+	 * @param col	column index
+	 * @return the cache node holding valid data for column col, or NO_NODE (a miss)
+	 **/
+	HOST_DEVICE int find(int col) const {
+		int n = columns[col];
+		if (n != NO_NODE && stage_idx[n] == -1) // valid cache node and not being staged
+			return n;
+		return NO_NODE;
+	}
+
+	/**
+	 * Picks the cache node to (re)fill with column col on a miss
+	 * @param col			column index
+	 * @param stage_area	area the column will be staged in
+	 * @return the least recently used node that can be reclaimed
+	 **/
+	HOST_DEVICE int victim(int col, StageArea_t stage_area) const {
+		// pick a buffer from the end (last recently used) of the cache
+		if (stage_area == STAGE_AREA_I) {
+			// State: STAGE_I --> STAGE_J
+			// Pre-condition: all cache nodes are available for eviction
+			return tail; // for I we pick the last to evict
+		}
+
+		// State: STAGE_J --> COMMIT
+		// Pre-condition: a cache node may be being read or modified by column I
+
+		// select a cache node that is not being staged for ANOTHER column (i.e. I) AND not being read
+		int n = tail;
+		while ((stage_idx[n] != -1 && stage_idx[n] != col) ||
+			used[n]) {
+			n = prev[n];
+		}
+		return n;
+	}
+
+	/**
+	 * Stages a hit node for reading
+	 **/
+	HOST_DEVICE void stage_hit(int n, StageArea_t stage_area) {
+		used[n] = 1; // indicate that this column is being read
+		staging_area[stage_area] = n; // put this in the staging area for later access
+	}
+
+	/**
+	 * Stages the victim node n to be written with column col
+	 * @return the column evicted from the cache, or -1
+	 **/
+	HOST_DEVICE int stage_miss(int n, int col, StageArea_t stage_area) {
+		int evicted = col_idx[n];
+		stage_idx[n] = col; // mark this cache node as being staged (new data will be written to it) for column col
+		staging_area[stage_area] = n; // put this in the staging area for later access
+		if (evicted != -1)			// remove from column table
+			columns[evicted] = NO_NODE;
+		col_idx[n] = col;				// remember where I am now assigned too
+		return evicted != col ? evicted : -1;
+	}
+
+	/**
+	 * Get the staged column
+	 * @param col	column index
+	 * @param stage_area	staging area to look up
+	 * @return column buffer, or NULL if col is not staged there
+	 * */
+	HOST_DEVICE CValue_t *get_Stage(int col, StageArea_t stage_area) const {
+		int n = staging_area[stage_area];
+		if (n != NO_NODE && col_idx[n] == col)
+			return column(n);
+		else
+			return NULL;
+	}
+
+	/**
+	 * Put the staged column buffer back into the LRU list
+	 * @param col			column index
+	 * @param stage_area	staging area for column buffer
+	 **/
+	HOST_DEVICE void commit(int col, StageArea_t stage_area) {
+		int n = staging_area[stage_area];
+		if (n == NO_NODE || col_idx[n] != col)
+			return ;
+
+		remove(n); // remove n from its position on the LRU list
+
+		col_idx[n] = col; // reassign it to a new column
+		used[n] = 0; // no longer being read
+		stage_idx[n] = -1; // no longer being modified
+		columns[col] = n; // assign it to its new position in the table
+
+		push_front(n); // now put it in front of the LRU list
+
+		staging_area[stage_area] = NO_NODE; // empty the staging area
+	}
+};
+
+/**
+ * Host image of the cache index of nr_node cache nodes for nr_column columns, in one
+ * int array: next, prev, col_idx, stage_idx and used of the nodes, then the column table.
+ * It starts as an empty cache with the nodes listed in order.
+ **/
+struct LRUCacheArrays {
+	int nr_node, nr_column;
+	std::vector<int> index;
+
+	LRUCacheArrays(int nr_node, int nr_column) :
+		nr_node(nr_node), nr_column(nr_column), index(5 * (size_t)nr_node + nr_column, -1) {
+		LRUCachePolicy p = policy(&index[0], NULL, 0);
+		for (int n = 0; n < nr_node; n++) {
+			p.prev[n] = n - 1;
+			p.next[n] = n + 1 < nr_node ? n + 1 : NO_NODE;
+			p.used[n] = 0;
+		}
+	}
+
+	/**
+	 * Policy state over a copy of index at base, on the host or the device
+	 * @param column_space	buffers of the cache nodes, col_size elements each
+	 **/
+	LRUCachePolicy policy(int *base, CValue_t *column_space, int col_size) const {
+		LRUCachePolicy p;
+		p.next = base;
+		p.prev = base + nr_node;
+		p.col_idx = base + 2 * (size_t)nr_node;
+		p.stage_idx = base + 3 * (size_t)nr_node;
+		p.used = base + 4 * (size_t)nr_node;
+		p.columns = base + 5 * (size_t)nr_node;
+		p.column_space = column_space;
+		p.col_size = col_size;
+		p.head = nr_node > 0 ? 0 : NO_NODE;
+		p.tail = nr_node - 1;
+		p.size = nr_node;
+		p.staging_area[STAGE_AREA_I] = p.staging_area[STAGE_AREA_J] = NO_NODE;
+		return p;
+	}
+};
+
+/**
+ * Checks the invariants of a cache index in host memory between two COMMITs
+ * @param nr_column	size of the column table
+ * @return NULL, or a description of the first violation found
+ **/
+static inline const char *check_cache_index(const LRUCachePolicy &p, int nr_column)
+{
+	int count = 0, last = NO_NODE;
+	for (int n = p.head; n != NO_NODE; n = p.next[n]) {
+		if (p.prev[n] != last)
+			return "prev link does not match next link";
+		if (++count > p.size)
+			return "LRU list longer than its size, or cyclic";
+		if (p.stage_idx[n] != -1 || p.used[n])
+			return "node still staged or in use after commit";
+		if (p.col_idx[n] != -1 && (p.col_idx[n] >= nr_column || p.columns[p.col_idx[n]] != n))
+			return "column table does not point back to the node of a cached column";
+		last = n;
+	}
+	if (count != p.size)
+		return "LRU list shorter than its size";
+	if (p.tail != last)
+		return "tail is not the last node of the LRU list";
+	if (p.staging_area[STAGE_AREA_I] != NO_NODE || p.staging_area[STAGE_AREA_J] != NO_NODE)
+		return "staging area not empty after commit";
+	for (int c = 0; c < nr_column; c++)
+		if (p.columns[c] != NO_NODE && p.col_idx[p.columns[c]] != c)
+			return "column table points to a node of another column";
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,153 @@
+/*
+** Copyright 2014 Edward Walker
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http ://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+
+** Description: Pooled allocator for the per-subproblem arrays of the solvers, so that
+** consecutive subproblems of the same or smaller size reuse the buffers of the last one
+*/
+#ifndef _MEMORY_POOL_H_
+#define _MEMORY_POOL_H_
+#include <stdlib.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include "svm.h"
+
+/**
+ * Allocator of host memory for MemoryPool
+ **/
+struct HostAllocator {
+	static void *allocate(size_t bytes) { return malloc(bytes); }
+	static void release(void *p) { free(p); }
+};
+
+/**
+ * Keeps released blocks for reuse instead of returning them to Allocator; a request
+ * is served by the smallest kept block large enough for it.  trim() returns the kept
+ * blocks to Allocator, and is called when svm_train returns.
+ * The counters are 64 bits, so they hold beyond 2 GB.
+ **/
+template <class Allocator>
+class MemoryPool {
+public:
+	MemoryPool() : current(0), peak(0), reserved(0), allocations(0), reuses(0) {}
+
+	~MemoryPool() {
+		// kept blocks only; blocks still in use belong to their owners
+		trim();
+	}
+
+	/**
+	 * @param bytes	size of the block
+	 * @return the block, or NULL if Allocator fails
+	 **/
+	void *acquire(size_t bytes) {
+		std::lock_guard<std::mutex> lock(mutex);
+		void *p;
+		if (bytes == 0)
+			bytes = 1; // a distinct block, as Allocator may return NULL for 0 bytes
+		std::multimap<size_t, void *>::iterator it = free_blocks.lower_bound(bytes);
+		if (it != free_blocks.end()) {
+			bytes = it->first; // the whole block is in use
+			p = it->second;
+			free_blocks.erase(it);
+			++reuses;
+		}
+		else {
+			p = Allocator::allocate(bytes);
+			if (p == NULL) {
+				// return what is kept to Allocator and try again
+				release_free_blocks();
+				p = Allocator::allocate(bytes);
+				if (p == NULL)
+					return NULL;
+			}
+			reserved += bytes;
+			++allocations;
+		}
+		used_blocks[p] = bytes;
+		current += bytes;
+		if (current > peak)
+			peak = current;
+		return p;
+	}
+
+	/**
+	 * Keeps a block returned by acquire() for reuse
+	 **/
+	void release(void *p) {
+		if (p == NULL)
+			return;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<void *, size_t>::iterator it = used_blocks.find(p);
+		if (it == used_blocks.end())
+			return;
+		current -= it->second;
+		free_blocks.insert(std::make_pair(it->second, p));
+		used_blocks.erase(it);
+	}
+
+	/**
+	 * Returns the kept blocks to Allocator
+	 **/
+	void trim() {
+		std::lock_guard<std::mutex> lock(mutex);
+		release_free_blocks();
+	}
+
+	void get_stats(svm_memory_stats *stats) {
+		std::lock_guard<std::mutex> lock(mutex);
+		stats->current = current;
+		stats->peak = peak;
+		stats->reserved = reserved;
+		stats->allocations = allocations;
+		stats->reuses = reuses;
+	}
+
+private:
+	std::mutex mutex;
+	std::multimap<size_t, void *> free_blocks; // by size
+	std::map<void *, size_t> used_blocks;
+	long long current, peak, reserved, allocations, reuses;
+
+	void release_free_blocks() {
+		for (std::multimap<size_t, void *>::iterator it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+			Allocator::release(it->second);
+			reserved -= it->first;
+		}
+		free_blocks.clear();
+	}
+};
+
+// pool of host memory, shared by all threads
+MemoryPool<HostAllocator> &host_memory_pool();
+
+struct HostPoolDeleter {
+	void operator()(void *p) { host_memory_pool().release(p); }
+};
+
+/**
+ * Host array from the pool, for plain types; its elements are not initialized
+ **/
+template <typename T>
+std::unique_ptr<T[], HostPoolDeleter> make_unique_host_array(size_t size)
+{
+	T *p = static_cast<T *>(host_memory_pool().acquire(size * sizeof(T)));
+	if (p == NULL)
+		throw std::bad_alloc();
+	return std::unique_ptr<T[], HostPoolDeleter>(p);
+}
+
+#endif
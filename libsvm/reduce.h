@@ -0,0 +1,125 @@
+/*
+** Copyright 2014 Edward Walker
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http ://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+
+** Description: Reductions to a maximum or minimum with its index, shared by the working
+** set selection of the host solver (host_reduce) and the device reducers (device_reduce.h)
+*/
+#ifndef _SVM_REDUCE_H_
+#define _SVM_REDUCE_H_
+#include <algorithm>
+#include "svm_defs.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Running maximum of (value, index) pairs.  Of equal values the larger index wins, as in
+ * the >= scans of Solver::select_working_set, so (value, index) is totally ordered and
+ * the result does not depend on the order of update() and merge(): every thread and
+ * block split gives the same answer.
+ * It has no constructor so that it can live in shared memory; init() starts it empty,
+ * with index -1, at the given value.
+ **/
+template <typename V>
+struct ArgMax {
+	V value;
+	int idx;
+
+	// true if (v1, i1) wins over (v2, i2)
+	HOST_DEVICE static bool prefer(V v1, int i1, V v2, int i2) {
+		return v1 > v2 || (v1 == v2 && i1 > i2);
+	}
+	HOST_DEVICE void init(V v) { value = v; idx = -1; }
+	HOST_DEVICE void update(V v, int i) {
+		if (prefer(v, i, value, idx)) {
+			value = v;
+			idx = i;
+		}
+	}
+	HOST_DEVICE void merge(const ArgMax &r) { update(r.value, r.idx); }
+};
+
+/**
+ * Running minimum of (value, index) pairs; of equal values the larger index wins,
+ * as in the <= scans of Solver::select_working_set
+ **/
+template <typename V>
+struct ArgMin {
+	V value;
+	int idx;
+
+	HOST_DEVICE static bool prefer(V v1, int i1, V v2, int i2) {
+		return v1 < v2 || (v1 == v2 && i1 > i2);
+	}
+	HOST_DEVICE void init(V v) { value = v; idx = -1; }
+	HOST_DEVICE void update(V v, int i) {
+		if (prefer(v, i, value, idx)) {
+			value = v;
+			idx = i;
+		}
+	}
+	HOST_DEVICE void merge(const ArgMin &r) { update(r.value, r.idx); }
+};
+
+/**
+ * Running maximum without an index
+ **/
+template <typename V>
+struct Max {
+	V value;
+
+	HOST_DEVICE static bool prefer(V v1, V v2) { return v1 > v2; }
+	HOST_DEVICE void init(V v) { value = v; }
+	HOST_DEVICE void update(V v) {
+		if (prefer(v, value))
+			value = v;
+	}
+	HOST_DEVICE void merge(const Max &r) { update(r.value); }
+};
+
+#define HOST_REDUCE_GRAIN	4096	// elements per thread below which host_reduce does not fork
+
+/**
+ * Reduces [0,n) on the host: f(t, r) folds element t into the partial result r, which
+ * starts as a copy of init, and R::merge() combines the partial results of the threads.
+ * Each thread scans a contiguous range, so f can be written for the compiler to vectorize.
+ * @return the result, in the type R of init
+ **/
+template <class R, class F>
+R host_reduce(int n, const R &init, F f)
+{
+	R result = init;
+#ifdef _OPENMP
+	int nr_thread = std::min(omp_get_max_threads(), n / HOST_REDUCE_GRAIN);
+	if (nr_thread > 1 && !omp_in_parallel()) {
+#pragma omp parallel num_threads(nr_thread)
+		{
+			int k = omp_get_thread_num(), m = omp_get_num_threads();
+			int begin = (int)((long long)n * k / m), end = (int)((long long)n * (k + 1) / m);
+			R r = init;
+			for (int t = begin; t < end; t++)
+				f(t, r);
+#pragma omp critical(host_reduce)
+			result.merge(r);
+		}
+		return result;
+	}
+#endif
+	for (int t = 0; t < n; t++)
+		f(t, result);
+	return result;
+}
+
+#endif
@@ -7,13 +7,25 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <locale.h>
+#include <stdint.h>
+#include <chrono>
+#include <atomic>
 #include "svm.h"
+#include "group_varint.h"
+#include "reduce.h"
 
 #include "cuda_solver.h" // CUDA INTEGRATION
 #include "cuda_solverNU.h" // CUDA INTEGRATION
 
+// the Kahan compensation of the gradient update (param.compensated_gradient)
+// needs value-safe floating point; icpc is given -fp-model precise by the Makefile
+#ifdef __FAST_MATH__
+#error "svm.cpp must not be compiled with fast math"
+#endif
+
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
+typedef unsigned short Qbf16;	// bfloat16: the upper half of an IEEE float
 typedef signed char schar;
 #ifndef min
 template <class T> static inline T min(T x, T y) { return (x < y) ? x : y; }
@@ -27,6 +39,27 @@ template <class S, class T> static inline void clone(T*& dst, S* src, int n)
 	dst = new T[n];
 	memcpy((void *)dst, (void *)src, sizeof(T)*n);
 }
+static inline Qbf16 to_bf16(Qfloat f)
+{
+	// round to nearest even
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	u += 0x7fff + ((u >> 16) & 1);
+	return (Qbf16)(u >> 16);
+}
+static inline Qfloat to_Qfloat(Qbf16 h)
+{
+	uint32_t u = (uint32_t)h << 16;
+	Qfloat f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+static inline Qfloat to_Qfloat(Qfloat f) { return f; }
+static inline double wall_time()
+{
+	// monotonic, in seconds
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 static inline double powi(double base, int times)
 {
 	double tmp = base, ret = 1.0;
@@ -38,8 +71,40 @@ static inline double powi(double base, int times)
 	}
 	return ret;
 }
+
+//
+// Counter-based random numbers (splitmix64 finalizer)
+//
+// the n-th number of a stream only depends on (seed, stream, n), so shuffles
+// are reproducible however calls are scheduled over threads
+//
+class Random
+{
+public:
+	Random(int seed, int stream)
+		: key(mix(((uint64_t)(unsigned int)seed << 32) | (unsigned int)stream)), counter(0) {}
+	// uniform in [0,n)
+	int next(int n)
+	{
+		return (int)(mix(key + 0x9e3779b97f4a7c15ULL * ++counter) % (uint64_t)n);
+	}
+private:
+	uint64_t key, counter;
+	static uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+};
+#define CV_STREAM 0	// Random stream of svm_cross_validation; pair p of svm_train uses CV_STREAM+1+p
+
 #define INF HUGE_VAL
 #define TAU 1e-12
+#define GRADIENT_BLOCK 256	// Q_j elements evaluated per step of the fused gradient update
+#define RECONSTRUCT_TILE 1024	// kernel values evaluated per tile in reconstruct_gradient
+#define GRADIENT_STALL_ITER 1000	// iterations without a smaller KKT gap before the gradient is refreshed
+#define TIME_CHECK_ITER 64	// iterations between checks of param->time_budget
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
 static void print_string_stdout(const char *s)
@@ -67,25 +132,48 @@ static void info(const char *fmt,...) {}
 //
 // l is the number of total data items
 // size is the cache size limit in bytes
+// elem_size is the size of a cached element, sizeof(Qfloat) or sizeof(Qbf16)
 //
 class Cache
 {
 public:
-	Cache(int l, long int size);
+	Cache(int l, long int size, int elem_size = sizeof(Qfloat));
 	~Cache();
 
 	// request data [0,len)
 	// return some position p where [p,len) need to be filled
 	// (p >= len if nothing needs to be filled)
-	int get_data(const int index, Qfloat **data, int len);
+	int get_data(const int index, Qfloat **data, int len)
+	{
+		char *block;
+		int start = get_block(index, &block, len);
+		*data = (Qfloat *)block;
+		return start;
+	}
+	int get_data(const int index, Qbf16 **data, int len)
+	{
+		char *block;
+		int start = get_block(index, &block, len);
+		*data = (Qbf16 *)block;
+		return start;
+	}
 	void swap_index(int i, int j);
+	// cut every cached column to [0,len), returning the space to the cache
+	void truncate(int len);
+	// fraction of get_data calls that needed no filling, < 0 before the first one
+	double hit_rate() const
+	{
+		return hits + misses > 0 ? (double)hits / (double)(hits + misses) : -1;
+	}
 private:
 	int l;
 	long int size;
+	int elem_size;
+	long int hits, misses;
 	struct head_t
 	{
 		head_t *prev, *next;	// a circular list
-		Qfloat *data;
+		char *data;
 		int len;		// data[0,len) is cached in this entry
 	};
 
@@ -93,13 +181,21 @@ private:
 	head_t lru_head;
 	void lru_delete(head_t *h);
 	void lru_insert(head_t *h);
+	int get_block(const int index, char **data, int len);
+	void swap_element(char *data, int i, int j)
+	{
+		if (elem_size == sizeof(Qbf16))
+			swap(((Qbf16 *)data)[i], ((Qbf16 *)data)[j]);
+		else
+			swap(((Qfloat *)data)[i], ((Qfloat *)data)[j]);
+	}
 };
 
-Cache::Cache(int l_, long int size_) :l(l_), size(size_)
+Cache::Cache(int l_, long int size_, int elem_size_) :l(l_), size(size_), elem_size(elem_size_), hits(0), misses(0)
 {
 	head = (head_t *)calloc(l, sizeof(head_t));	// initialized to 0
-	size /= sizeof(Qfloat);
-	size -= l * sizeof(head_t) / sizeof(Qfloat);
+	size /= elem_size;
+	size -= l * sizeof(head_t) / elem_size;
 	size = max(size, 2 * (long int)l);	// cache must be large enough for two columns
 	lru_head.next = lru_head.prev = &lru_head;
 }
@@ -127,7 +223,7 @@ void Cache::lru_insert(head_t *h)
 	h->next->prev = h;
 }
 
-int Cache::get_data(const int index, Qfloat **data, int len)
+int Cache::get_block(const int index, char **data, int len)
 {
 	head_t *h = &head[index];
 	if (h->len) lru_delete(h);
@@ -135,6 +231,8 @@ int Cache::get_data(const int index, Qfloat **data, int len)
 
 	if (more > 0)
 	{
+		++misses;
+
 		// free old space
 		while (size < more)
 		{
@@ -147,10 +245,12 @@ int Cache::get_data(const int index, Qfloat **data, int len)
 		}
 
 		// allocate new space
-		h->data = (Qfloat *)realloc(h->data, sizeof(Qfloat)*len);
+		h->data = (char *)realloc(h->data, (size_t)elem_size*len);
 		size -= more;
 		swap(h->len, len);
 	}
+	else
+		++hits;
 
 	lru_insert(h);
 	*data = h->data;
@@ -174,7 +274,7 @@ void Cache::swap_index(int i, int j)
 		if (h->len > i)
 		{
 			if (h->len > j)
-				swap(h->data[i], h->data[j]);
+				swap_element(h->data, i, j);
 			else
 			{
 				// give up
@@ -188,6 +288,26 @@ void Cache::swap_index(int i, int j)
 	}
 }
 
+void Cache::truncate(int len)
+{
+	for (head_t *h = lru_head.next; h != &lru_head; h = h->next)
+	{
+		if (h->len > len)
+		{
+			size += h->len - len;
+			if (len > 0)
+				h->data = (char *)realloc(h->data, (size_t)elem_size*len);
+			else
+			{
+				lru_delete(h);
+				free(h->data);
+				h->data = 0;
+			}
+			h->len = len;
+		}
+	}
+}
+
 //
 // Kernel evaluation
 //
@@ -198,8 +318,27 @@ void Cache::swap_index(int i, int j)
 class QMatrix {
 public:
 	virtual Qfloat *get_Q(int column, int len) const = 0;
+	// like get_Q, but the part of the column that is not cached yet, [start,len),
+	// is left for the caller to fill with fill_Q (so it can be consumed while hot)
+	virtual Qfloat *get_Q_lazy(int column, int len, int &start) const
+	{
+		start = len;
+		return get_Q(column, len);
+	}
+	virtual void fill_Q(int column, Qfloat *data, int from, int to) const {}
+	// the same for columns cached as bfloat16 (param.cache_precision == CACHE_BF16);
+	// get_Q still returns Qfloat, converted into one of two buffers
+	virtual bool is_bf16_cache() const { return false; }
+	virtual Qbf16 *get_Q_lazy_bf16(int column, int len, int &start) const { start = len; return NULL; }
+	virtual void fill_Q(int column, Qbf16 *data, int from, int to) const {}
+	// computes Q(i,idx[0]),...,Q(i,idx[n-1]) into out without going through the cache;
+	// it is called concurrently from several threads
+	virtual void get_Q_subset(int i, const int *idx, int n, Qfloat *out) const = 0;
 	virtual double *get_QD() const = 0;
 	virtual void swap_index(int i, int j) const = 0;
+	virtual double get_cache_hit_rate() const { return -1; }
+	// called by shrinking with the new active_size (param.compact_cache)
+	virtual void truncate_cache(int len) const {}
 	virtual ~QMatrix() {}
 };
 
@@ -216,6 +355,7 @@ public:
 	{
 		swap(x[i], x[j]);
 		if (x_square) swap(x_square[i], x_square[j]);
+		if (rows) rows->swap_index(i, j);
 	}
 protected:
 
@@ -224,6 +364,7 @@ protected:
 private:
 	const svm_node **x;
 	double *x_square;
+	GroupVarintRows *rows;	// x with coded indices, NULL unless param.index_compression
 
 	// svm_parameter
 	const int kernel_type;
@@ -232,21 +373,25 @@ private:
 	const double coef0;
 
 	static double dot(const svm_node *px, const svm_node *py);
+	double dot(int i, int j) const
+	{
+		return rows ? GroupVarintRows::dot(rows->row(i), rows->row(j)) : dot(x[i], x[j]);
+	}
 	double kernel_linear(int i, int j) const
 	{
-		return dot(x[i], x[j]);
+		return dot(i, j);
 	}
 	double kernel_poly(int i, int j) const
 	{
-		return powi(gamma*dot(x[i], x[j]) + coef0, degree);
+		return powi(gamma*dot(i, j) + coef0, degree);
 	}
 	double kernel_rbf(int i, int j) const
 	{
-		return exp(-gamma*(x_square[i] + x_square[j] - 2 * dot(x[i], x[j])));
+		return exp(-gamma*(x_square[i] + x_square[j] - 2 * dot(i, j)));
 	}
 	double kernel_sigmoid(int i, int j) const
 	{
-		return tanh(gamma*dot(x[i], x[j]) + coef0);
+		return tanh(gamma*dot(i, j) + coef0);
 	}
 	double kernel_precomputed(int i, int j) const
 	{
@@ -294,12 +439,17 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 	}
 	else
 		x_square = 0;
+
+	rows = NULL;
+	if (param.index_compression && kernel_type != PRECOMPUTED && cudaSolver == nullptr)
+		rows = new GroupVarintRows(l, x);
 }
 
 Kernel::~Kernel()
 {
 	delete[] x;
 	delete[] x_square;
+	delete rows;
 }
 
 double Kernel::dot(const svm_node *px, const svm_node *py)
@@ -383,6 +533,27 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 	}
 }
 
+// partial results of the working set selection scans, for host_reduce
+struct SelectJ
+{
+	Max<double> Gmax2;
+	ArgMin<double> obj_diff;
+	void merge(const SelectJ &r) { Gmax2.merge(r.Gmax2); obj_diff.merge(r.obj_diff); }
+};
+
+struct SelectNuI
+{
+	ArgMax<double> Gmaxp, Gmaxn;
+	void merge(const SelectNuI &r) { Gmaxp.merge(r.Gmaxp); Gmaxn.merge(r.Gmaxn); }
+};
+
+struct SelectNuJ
+{
+	Max<double> Gmaxp2, Gmaxn2;
+	ArgMin<double> obj_diff;
+	void merge(const SelectNuJ &r) { Gmaxp2.merge(r.Gmaxp2); Gmaxn2.merge(r.Gmaxn2); obj_diff.merge(r.obj_diff); }
+};
+
 // An SMO algorithm in Fan et al., JMLR 6(2005), p. 1889--1918
 // Solves:
 //
@@ -412,15 +583,20 @@ public:
 		double upper_bound_p;
 		double upper_bound_n;
 		double r;	// for Solver_NU
+		double start_time;	// wall_time() when loading the problem began, set by the caller
+		int stop_reason;	// STOP_OPTIMAL, STOP_MAX_ITER, STOP_TIME_BUDGET or STOP_OBJECTIVE_STALL
+		svm_telemetry telemetry;	// filled in if param->telemetry is set
 	};
 
 	void Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		double *alpha_, double Cp, double Cn, double eps,
-		SolutionInfo* si, int shrinking);
+		SolutionInfo* si, int shrinking, const svm_parameter *param);
 protected:
 	int active_size;
 	schar *y;
 	double *G;		// gradient of objective function
+	double *G_comp;		// Kahan compensation of G, NULL unless param->compensated_gradient
+	double kkt_gap;		// maximal violation seen by the last select_working_set
 	enum { LOWER_BOUND, UPPER_BOUND, FREE };
 	char *alpha_status;	// LOWER_BOUND, UPPER_BOUND, FREE
 	double *alpha;
@@ -431,9 +607,51 @@ protected:
 	double *p;
 	int *active_set;
 	double *G_bar;		// gradient, if we treat free variables as 0
+	double *G_bar_delta;	// deferred G_bar updates: G_bar += G_bar_delta[i] * Q_i
+	int nr_G_bar_delta;	// number of updates queued in G_bar_delta
 	int l;
 	bool unshrink;	// XXX
 
+	// telemetry; phases are timed only if param->telemetry is set
+	const svm_parameter *param;
+	svm_telemetry *telemetry;	// NULL if disabled
+	int phase;		// phase the time since phase_start is charged to
+	double phase_start;
+	int enter_phase(int next)
+	{
+		// charge the time since the last switch to the current phase, which is returned
+		int prev = phase;
+		if (telemetry)
+		{
+			double now = wall_time();
+			telemetry->phase_time[phase] += now - phase_start;
+			phase_start = now;
+		}
+		phase = next;
+		return prev;
+	}
+	void report_telemetry(int event, int iter);
+	void end_eps_stage(int iter, double obj, double final_eps);
+
+	// working-set trace, kept in memory and appended to param->trace_file at the end
+	svm_trace_record *trace;
+	int nr_trace, max_trace;
+	void add_trace(int i, int j, int active_size, double delta_alpha_i, double delta_alpha_j)
+	{
+		if (nr_trace == max_trace)
+		{
+			max_trace = max(2 * max_trace, 1024);
+			trace = (svm_trace_record *)realloc(trace, max_trace * sizeof(svm_trace_record));
+		}
+		svm_trace_record& r = trace[nr_trace++];
+		r.i = i;
+		r.j = j;
+		r.active_size = active_size;
+		r.delta_alpha_i = (float)delta_alpha_i;
+		r.delta_alpha_j = (float)delta_alpha_j;
+	}
+	void write_trace();
+
 	double get_C(int i)
 	{
 		return (y[i] > 0) ? Cp : Cn;
@@ -450,7 +668,84 @@ protected:
 	bool is_lower_bound(int i) { return alpha_status[i] == LOWER_BOUND; }
 	bool is_free(int i) { return alpha_status[i] == FREE; }
 	void swap_index(int i, int j);
+	void queue_G_bar_update(int i, double C_i);
+	void update_G_bar();
+	template <class T> void update_G(int from, int to, const Qfloat *Q_i, const T *Q_j, double delta_alpha_i, double delta_alpha_j)
+	{
+		int k;
+		if (G_comp == NULL)
+		{
+			for (k = from; k < to; k++)
+				G[k] += Q_i[k] * delta_alpha_i + to_Qfloat(Q_j[k]) * delta_alpha_j;
+			return;
+		}
+		for (k = from; k < to; k++)
+		{
+			double d = Q_i[k] * delta_alpha_i + to_Qfloat(Q_j[k]) * delta_alpha_j - G_comp[k];
+			double t = G[k] + d;
+			G_comp[k] = (t - G[k]) - d;	// zero if reassociated (see __FAST_MATH__ above)
+			G[k] = t;
+		}
+	}
+	template <class T> void update_G_fused(int j, T *Q_j, int start, const Qfloat *Q_i, double delta_alpha_i, double delta_alpha_j)
+	{
+		// fused evaluate-store-update (cf. cuda_update_gradient): the uncached
+		// part of Q_j is computed a block at a time and folded into G while
+		// the block is still in cache, so each x[k] is touched once.
+		// With param->fused_select each updated block is also searched for i of
+		// the next working set, so select_working_set sweeps G once instead of twice
+		bool fuse = param->fused_select != 0;
+		if (fuse)
+			begin_fused_i();
+		int k = min(start, active_size);
+		if (fuse)
+		{
+			for (int from = 0; from < k; from += GRADIENT_BLOCK)
+			{
+				int to = min(from + GRADIENT_BLOCK, k);
+				update_G(from, to, Q_i, Q_j, delta_alpha_i, delta_alpha_j);
+				fuse_i(from, to);
+			}
+		}
+		else
+			update_G(0, k, Q_i, Q_j, delta_alpha_i, delta_alpha_j);
+		for (; k < active_size; k += GRADIENT_BLOCK)
+		{
+			int end = min(k + GRADIENT_BLOCK, active_size);
+			Q->fill_Q(j, Q_j, k, end);
+			update_G(k, end, Q_i, Q_j, delta_alpha_i, delta_alpha_j);
+			if (fuse)
+				fuse_i(k, end);
+		}
+		fused_i_valid = fuse;
+	}
+
+	// i of the next working set as found by update_G_fused; alpha_status must be
+	// updated before G, and anything else that changes G or the active set clears it
+	bool fused_i_valid;
+	ArgMax<double> fused_i;
+	void fold_i(int t, ArgMax<double> &r)
+	{
+		if (y[t] == +1)
+		{
+			if (!is_upper_bound(t))
+				r.update(-G[t], t);
+		}
+		else
+		{
+			if (!is_lower_bound(t))
+				r.update(G[t], t);
+		}
+	}
+	virtual void begin_fused_i() { fused_i.init(-INF); }
+	virtual void fuse_i(int from, int to)
+	{
+		for (int t = from; t < to; t++)
+			fold_i(t, fused_i);
+	}
+	double dot_Q_subset(int i, const int *idx, const double *coef, int n, Qfloat *tile) const;
 	void reconstruct_gradient();
+	void refresh_gradient();
 	virtual int select_working_set(int &i, int &j);
 	virtual double calculate_rho();
 	virtual void do_shrinking();
@@ -460,22 +755,72 @@ private:
 
 void Solver::swap_index(int i, int j)
 {
+	if (param->trace_file)
+		add_trace(i, j, -1, 0, 0);
 	Q->swap_index(i, j);
 	swap(y[i], y[j]);
 	swap(G[i], G[j]);
+	if (G_comp) swap(G_comp[i], G_comp[j]);
 	swap(alpha_status[i], alpha_status[j]);
 	swap(alpha[i], alpha[j]);
 	swap(p[i], p[j]);
 	swap(active_set[i], active_set[j]);
 	swap(G_bar[i], G_bar[j]);
+	swap(G_bar_delta[i], G_bar_delta[j]);
+}
+
+void Solver::queue_G_bar_update(int i, double C_i)
+{
+	// G_bar is only read by reconstruct_gradient(), so instead of sweeping a full
+	// column every time alpha_i moves to or from the upper bound we remember the
+	// coefficient; opposite transitions of the same variable cancel out
+	G_bar_delta[i] += C_i;
+	++nr_G_bar_delta;
+}
+
+void Solver::update_G_bar()
+{
+	// apply the deferred G_bar updates, two columns per sweep over G_bar
+	if (nr_G_bar_delta == 0) return;
+
+	int i = 0, j, k;
+	while (true)
+	{
+		while (i < l && G_bar_delta[i] == 0) i++;
+		if (i == l) break;
+		for (j = i + 1; j < l && G_bar_delta[j] == 0; j++);
+
+		const Qfloat *Q_i = Q->get_Q(i, l);
+		double delta_i = G_bar_delta[i];
+		G_bar_delta[i] = 0;
+		if (j == l)
+		{
+			for (k = 0; k < l; k++)
+				G_bar[k] += delta_i * Q_i[k];
+			break;
+		}
+
+		// the cache always holds two full columns, so Q_i is still valid here
+		const Qfloat *Q_j = Q->get_Q(j, l);
+		double delta_j = G_bar_delta[j];
+		G_bar_delta[j] = 0;
+		for (k = 0; k < l; k++)
+			G_bar[k] += delta_i * Q_i[k] + delta_j * Q_j[k];
+		i = j + 1;
+	}
+	nr_G_bar_delta = 0;
 }
 
 void Solver::reconstruct_gradient()
 {
 	// reconstruct inactive elements of G from G_bar and free variables
+	fused_i_valid = false;
 
 	if (active_size == l) return;
 
+	int prev_phase = enter_phase(PHASE_RECONSTRUCT);
+	update_G_bar();
+
 	int i, j;
 	int nr_free = 0;
 
@@ -489,32 +834,89 @@ void Solver::reconstruct_gradient()
 	if (2 * nr_free < active_size)
 		info("\nWARNING: using -h 0 may be faster\n");
 
-	if (nr_free*l > 2 * active_size*(l - active_size))
+	// Only the nr_free*(l-active_size) entries Q(i,j), i inactive and j free, are
+	// needed.  They are evaluated in tiles outside the kernel cache, so the one-shot
+	// rows of inactive variables neither evict hot columns nor serialize on it.
+	int *free_idx = new int[nr_free];
+	double *free_alpha = new double[nr_free];
+	nr_free = 0;
+	for (j = 0; j < active_size; j++)
+		if (is_free(j))
+		{
+			free_idx[nr_free] = j;
+			free_alpha[nr_free] = alpha[j];
+			nr_free++;
+		}
+
+#pragma omp parallel private(i)
 	{
+		Qfloat *Q_tile = new Qfloat[RECONSTRUCT_TILE];
+#pragma omp for schedule(dynamic, 16)
 		for (i = active_size; i < l; i++)
 		{
-			const Qfloat *Q_i = Q->get_Q(i, active_size);
-			for (j = 0; j < active_size; j++)
-				if (is_free(j))
-					G[i] += alpha[j] * Q_i[j];
+			G[i] += dot_Q_subset(i, free_idx, free_alpha, nr_free, Q_tile);
+			if (G_comp) G_comp[i] = 0;
 		}
+		delete[] Q_tile;
 	}
-	else
+
+	delete[] free_idx;
+	delete[] free_alpha;
+	enter_phase(prev_phase);
+}
+
+double Solver::dot_Q_subset(int i, const int *idx, const double *coef, int n, Qfloat *tile) const
+{
+	// sum of coef[t]*Q(i,idx[t]), evaluated RECONSTRUCT_TILE entries at a time
+	double sum = 0;
+	for (int t = 0; t < n; t += RECONSTRUCT_TILE)
+	{
+		int m = min(RECONSTRUCT_TILE, n - t);
+		Q->get_Q_subset(i, &idx[t], m, tile);
+		for (int k = 0; k < m; k++)
+			sum += coef[t + k] * tile[k];
+	}
+	return sum;
+}
+
+void Solver::refresh_gradient()
+{
+	// recompute the active part of G from scratch, discarding the rounding
+	// error accumulated by the incremental updates; inactive elements are
+	// rebuilt by reconstruct_gradient() anyway
+	fused_i_valid = false;
+	int prev_phase = enter_phase(PHASE_RECONSTRUCT);
+	int i, n = 0;
+	int *sv_idx = new int[l];
+	double *sv_alpha = new double[l];
+	for (i = 0; i < l; i++)
+		if (!is_lower_bound(i))
+		{
+			sv_idx[n] = i;
+			sv_alpha[n] = alpha[i];
+			n++;
+		}
+
+#pragma omp parallel private(i)
 	{
+		Qfloat *Q_tile = new Qfloat[RECONSTRUCT_TILE];
+#pragma omp for schedule(dynamic, 16)
 		for (i = 0; i < active_size; i++)
-			if (is_free(i))
-			{
-			const Qfloat *Q_i = Q->get_Q(i, l);
-			double alpha_i = alpha[i];
-			for (j = active_size; j < l; j++)
-				G[j] += alpha_i * Q_i[j];
-			}
+		{
+			G[i] = p[i] + dot_Q_subset(i, sv_idx, sv_alpha, n, Q_tile);
+			if (G_comp) G_comp[i] = 0;
+		}
+		delete[] Q_tile;
 	}
+
+	delete[] sv_idx;
+	delete[] sv_alpha;
+	enter_phase(prev_phase);
 }
 
 void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	double *alpha_, double Cp, double Cn, double eps,
-	SolutionInfo* si, int shrinking)
+	SolutionInfo* si, int shrinking, const svm_parameter *param)
 {
 	this->l = l;
 	this->Q = &Q;
@@ -526,6 +928,19 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	this->Cn = Cn;
 	this->eps = eps;
 	unshrink = false;
+	this->param = param;
+	telemetry = NULL;
+	if (param->telemetry)
+	{
+		telemetry = &si->telemetry;
+		memset(telemetry, 0, sizeof(svm_telemetry));
+		telemetry->l = l;
+	}
+	trace = NULL;
+	nr_trace = max_trace = 0;
+	phase = PHASE_LOAD;
+	phase_start = si->start_time;
+	enter_phase(PHASE_INIT_GRADIENT);
 
 	// initialize alpha_status
 	{
@@ -545,12 +960,22 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	// initialize gradient
 	{
 		G = new double[l];
+		G_comp = NULL;
+		if (param->compensated_gradient && !cudaSolver)
+		{
+			G_comp = new double[l];
+			for (int i = 0; i < l; i++)
+				G_comp[i] = 0;
+		}
 		G_bar = new double[l];
+		G_bar_delta = new double[l];
+		nr_G_bar_delta = 0;
 		int i;
 		for (i = 0; i < l; i++)
 		{
 			G[i] = p[i];
 			G_bar[i] = 0;
+			G_bar_delta[i] = 0;
 		}
 		if (cudaSolver) {
 			cudaSolver->setup_solver(y, G, alpha, alpha_status, Cp, Cn, l); // CUDA INTEGRATION
@@ -575,28 +1000,159 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 
 	int iter = 0;
 	int max_iter = max(10000000, l > INT_MAX / 100 ? INT_MAX : 100 * l);
+
+	// coarse-to-fine tolerance: all but the last stage stop on the active set
+	// alone and shrink ten times as often
+	double final_eps = eps;
+	if (param->eps_stages > 1)
+	{
+		this->eps = eps * pow(10.0, param->eps_stages - 1);
+		if (cudaSolver)
+			cudaSolver->set_eps(this->eps);
+	}
 	int counter = min(l, 1000) + 1;
+	kkt_gap = INF;
+	fused_i_valid = false;
+	int refresh_iter = 0, stall_iter = 0;	// iterations of the last refresh and of the last smaller gap
+	double best_gap = INF;
+	int stop_reason = STOP_OPTIMAL;
+	double deadline = si->start_time + param->time_budget;
+
+	// the objective is tracked incrementally from the two-variable updates
+	// (on the device it is recomputed when needed instead)
+	bool track_obj = param->objective_window > 0 || param->eps_stages > 1;
+	double obj = 0, window_obj = 0;
+	if (track_obj)
+	{
+		if (cudaSolver)
+			obj = cudaSolver->get_objective(p, l);
+		else
+			for (int i = 0; i < l; i++)
+				obj += alpha[i] * (G[i] + p[i]) / 2;
+		window_obj = obj;
+	}
+
+	// The stopping condition is acted on only every check_interval iterations,
+	// and on those that synchronize anyway.  On the device select_working_set()
+	// tests it itself and the steps after it holds are no-ops, so the host need
+	// not wait for the test every iteration; on the host the steps after it are
+	// skipped the same way.  The idle iterations are then taken back, and the
+	// result is the same as with a check every iteration.
+	int check_interval = max(param->check_interval, 1);
+	int next_check = 0;
+	int idle_iter = 0;	// host: iterations since select_working_set() found the solution optimal
+	bool converged = false;
 
 	while (iter < max_iter)
 	{
+		bool check = iter >= next_check || iter + 1 >= max_iter
+			|| (param->time_budget > 0 && iter % TIME_CHECK_ITER == 0)
+			|| (param->objective_window > 0 && iter > 0 && iter % param->objective_window == 0)
+			|| (param->gradient_refresh > 0 && iter > 0 && (iter - refresh_iter >= param->gradient_refresh || iter - stall_iter >= GRADIENT_STALL_ITER))
+			|| (telemetry && param->telemetry_interval > 0 && (iter + 1) % param->telemetry_interval == 0);
+		if (iter >= next_check)
+			next_check = iter + check_interval;
+		if (cudaSolver && check && cudaSolver->check_convergence())
+		{
+			// converged at the select of an earlier iteration
+			int idle = cudaSolver->get_idle_iterations();
+			iter -= idle;
+			if (param->trace_file)
+				nr_trace -= idle;
+			converged = true;
+		}
+		else if (idle_iter > 0)
+		{
+			if (!check)
+			{
+				++iter;
+				++idle_iter;
+				continue;
+			}
+			iter -= idle_iter;
+			idle_iter = 0;
+			converged = true;
+		}
+
 		// show progress and do shrinking
 
-		if (--counter == 0)
+		if (!converged && --counter == 0)
 		{
-			counter = min(l, 1000);
+			counter = min(l, this->eps > final_eps ? 100 : 1000);
+			enter_phase(PHASE_SHRINK);
 			if (shrinking) do_shrinking();
 			info(".");
 		}
 
+		// periodically recompute G to bound the drift of the incremental updates
+		if (!converged && param->gradient_refresh > 0 && iter > 0)
+		{
+			if (kkt_gap < best_gap)
+			{
+				best_gap = kkt_gap;
+				stall_iter = iter;
+			}
+			if (iter - refresh_iter >= param->gradient_refresh || iter - stall_iter >= GRADIENT_STALL_ITER)
+			{
+				enter_phase(PHASE_RECONSTRUCT);
+				if (cudaSolver)
+					cudaSolver->refresh_gradient(l);
+				else
+					refresh_gradient();
+				refresh_iter = stall_iter = iter;
+				best_gap = INF;
+			}
+		}
+
+		// stop early on the time budget or a stalled objective
+		if (!converged && param->time_budget > 0 && iter % TIME_CHECK_ITER == 0 && wall_time() > deadline)
+		{
+			stop_reason = STOP_TIME_BUDGET;
+			break;
+		}
+		if (!converged && param->objective_window > 0 && iter > 0 && iter % param->objective_window == 0)
+		{
+			if (cudaSolver)
+				obj = cudaSolver->get_objective(p, l);
+			if (window_obj - obj < param->objective_tol * max(1.0, fabs(obj)))
+			{
+				stop_reason = STOP_OBJECTIVE_STALL;
+				break;
+			}
+			window_obj = obj;
+		}
+
 		int i, j;
+		enter_phase(PHASE_SELECT);
 		if (cudaSolver) {
-			if (cudaSolver->select_working_set(i, j, l) != 0) {
+			int optimal = converged ? 1 : cudaSolver->select_working_set(i, j, l, check);
+			converged = false;
+			while (optimal != 0 && this->eps > final_eps)
+			{
+				end_eps_stage(iter, obj, final_eps);
+				optimal = cudaSolver->select_working_set(i, j, l);
+			}
+			kkt_gap = cudaSolver->get_kkt_gap();
+			if (optimal != 0) {
 				info("*");
 				break;
 			}
 		}
 		else {
-			if (select_working_set(i, j) != 0)
+			int optimal = converged ? 1 : select_working_set(i, j);
+			converged = false;
+			if (optimal != 0 && !check)
+			{
+				++iter;
+				++idle_iter;
+				continue;
+			}
+			while (optimal != 0 && this->eps > final_eps)
+			{
+				end_eps_stage(iter, obj, final_eps);	// keep the active set and gradient
+				optimal = select_working_set(i, j);
+			}
+			if (optimal != 0)
 			{
 				// reconstruct the whole gradient
 				reconstruct_gradient();
@@ -611,6 +1167,8 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		}
 
 		++iter;
+		if (telemetry && param->telemetry_interval > 0 && iter % param->telemetry_interval == 0)
+			report_telemetry(TELEMETRY_SAMPLE, iter);
 
 		// update alpha[i] and alpha[j], handle bounds carefully
 		Qfloat *Q_i;
@@ -621,11 +1179,13 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		double old_alpha_j;
 
 		if (cudaSolver) {
+			enter_phase(PHASE_UPDATE);
 			cudaSolver->compute_alpha();
 		}
 		else {
-			Q_i = Q.get_Q(i, active_size);
-			Q_j = Q.get_Q(j, active_size);
+			enter_phase(PHASE_KERNEL);
+			Q_i = Q.get_Q(i, active_size); // cached by select_working_set; Q_j is only needed for the gradient update below
+			enter_phase(PHASE_UPDATE);
 
 			C_i = get_C(i);
 			C_j = get_C(j);
@@ -720,62 +1280,85 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 				}
 			}
 		}
+		// update alpha_status first on the host, where the update of G may also
+		// search the new gradient for the next i (param->fused_select)
+		bool ui, uj;
+		if (!cudaSolver)
+		{
+			ui = is_upper_bound(i);
+			uj = is_upper_bound(j);
+			update_alpha_status(i);
+			update_alpha_status(j);
+		}
+
 		// update G
 		if (cudaSolver) {
 			cudaSolver->update_gradient(l);
+			if (param->trace_file)
+			{
+				// i and j are only known on the device
+				cudaSolver->fetch_working_set(i, j);
+				add_trace(i, j, l, 0, 0);
+			}
 		}
 		else
 		{
 			double delta_alpha_i = alpha[i] - old_alpha_i;
 			double delta_alpha_j = alpha[j] - old_alpha_j;
+			if (param->trace_file)
+				add_trace(i, j, active_size, delta_alpha_i, delta_alpha_j);
 
-			for (int k = 0; k < active_size; k++)
+			if (track_obj)
+				obj += delta_alpha_i * G[i] + delta_alpha_j * G[j] + delta_alpha_i * delta_alpha_j * Q_i[j]
+					+ (delta_alpha_i * delta_alpha_i * QD[i] + delta_alpha_j * delta_alpha_j * QD[j]) / 2;
+
+			// a bfloat16 Q_j is converted as it is read
+			int start;
+			if (Q.is_bf16_cache())
 			{
-				G[k] += Q_i[k] * delta_alpha_i + Q_j[k] * delta_alpha_j;
+				Qbf16 *Qh_j = Q.get_Q_lazy_bf16(j, active_size, start);
+				update_G_fused(j, Qh_j, start, Q_i, delta_alpha_i, delta_alpha_j);
+			}
+			else
+			{
+				Q_j = Q.get_Q_lazy(j, active_size, start);
+				update_G_fused(j, Q_j, start, Q_i, delta_alpha_i, delta_alpha_j);
 			}
 		}
 
-		// update alpha_status and G_bar
+		// update G_bar (and alpha_status on the device)
 		if (cudaSolver) {
 			cudaSolver->update_alpha_status();
 		}
 		else
 		{
-			bool ui = is_upper_bound(i);
-			bool uj = is_upper_bound(j);
-			update_alpha_status(i);
-			update_alpha_status(j);
-			int k;
 			if (ui != is_upper_bound(i))
-			{
-				Q_i = Q.get_Q(i, l);
-				if (ui)
-					for (k = 0; k < l; k++)
-						G_bar[k] -= C_i * Q_i[k];
-				else
-					for (k = 0; k < l; k++)
-						G_bar[k] += C_i * Q_i[k];
-			}
-
+				queue_G_bar_update(i, ui ? -C_i : C_i);
 			if (uj != is_upper_bound(j))
-			{
-				Q_j = Q.get_Q(j, l);
-				if (uj)
-					for (k = 0; k < l; k++)
-						G_bar[k] -= C_j * Q_j[k];
-				else
-					for (k = 0; k < l; k++)
-						G_bar[k] += C_j * Q_j[k];
-			}
+				queue_G_bar_update(j, uj ? -C_j : C_j);
 		}
 	}
 
 	if (cudaSolver) {
+		if (cudaSolver->check_convergence()) {
+			// converged in the iterations since the last check
+			int idle = cudaSolver->get_idle_iterations();
+			iter -= idle;
+			if (param->trace_file)
+				nr_trace -= idle;
+			stop_reason = STOP_OPTIMAL;
+		}
+		if (param->gradient_refresh > 0) {
+			enter_phase(PHASE_RECONSTRUCT);
+			cudaSolver->refresh_gradient(l);
+		}
 		// copy d_G, d_alpha, and d_alpha_status back to host
 		cudaSolver->fetch_vectors(G, alpha, alpha_status, l);
 	}
 
 	if (iter >= max_iter)
+		stop_reason = STOP_MAX_ITER;
+	if (stop_reason != STOP_OPTIMAL)
 	{
 		if (active_size < l)
 		{
@@ -784,11 +1367,22 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			active_size = l;
 			info("*");
 		}
-		fprintf(stderr, "\nWARNING: reaching max number of iterations\n");
+		if (stop_reason == STOP_MAX_ITER)
+			fprintf(stderr, "\nWARNING: reaching max number of iterations\n");
+		else
+			info("\nstopped early (%s) at a KKT gap of %g\n",
+				stop_reason == STOP_TIME_BUDGET ? "time budget" : "objective stalled", kkt_gap);
 	}
+	si->stop_reason = stop_reason;
+	if (param->trace_file)
+		write_trace();
+
+	if (param->gradient_refresh > 0 && !cudaSolver)
+		refresh_gradient();
 
 	// calculate rho
 
+	enter_phase(PHASE_RHO);
 	si->rho = calculate_rho();
 
 	// calculate objective value
@@ -820,13 +1414,93 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 
 	info("\noptimization finished, #iter = %d\n", iter);
 
+	if (telemetry)
+	{
+		telemetry->obj = si->obj;
+		telemetry->rho = si->rho;
+		telemetry->eps = eps;
+		telemetry->stop_reason = stop_reason;
+		report_telemetry(TELEMETRY_SUMMARY, iter);
+	}
+
 	delete[] p;
 	delete[] y;
 	delete[] alpha;
 	delete[] alpha_status;
 	delete[] active_set;
 	delete[] G;
+	delete[] G_comp;
 	delete[] G_bar;
+	delete[] G_bar_delta;
+}
+
+void Solver::write_trace()
+{
+	svm_trace_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SVM_TRACE_MAGIC;
+	header.svm_type = param->svm_type;
+	header.l = l;
+	header.cache_precision = param->cache_precision;
+	header.cache_size = param->cache_size;
+	header.nr_record = nr_trace;
+	header.cuda = cudaSolver != NULL;
+
+	// subproblems may be solved concurrently (cross validation)
+#pragma omp critical(svm_trace)
+	{
+		FILE *fp = fopen(param->trace_file, "ab");
+		if (fp == NULL)
+			fprintf(stderr, "can't open trace file %s\n", param->trace_file);
+		else
+		{
+			if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+				(nr_trace > 0 && fwrite(trace, sizeof(svm_trace_record), nr_trace, fp) != (size_t)nr_trace))
+				fprintf(stderr, "error writing trace file %s\n", param->trace_file);
+			fclose(fp);
+		}
+	}
+	free(trace);
+	trace = NULL;
+	nr_trace = max_trace = 0;
+}
+
+void Solver::report_telemetry(int event, int iter)
+{
+	enter_phase(phase);	// bring phase_time up to date
+	telemetry->event = event;
+	telemetry->iter = iter;
+	telemetry->active_size = cudaSolver ? l : active_size;
+	telemetry->kkt_gap = kkt_gap;
+	telemetry->cache_hit_rate = cudaSolver ? cudaSolver->get_cache_hit_rate() : Q->get_cache_hit_rate();
+	param->telemetry(telemetry, param->telemetry_data);
+	phase_start = wall_time();	// the callback is not charged to any phase
+}
+
+void Solver::end_eps_stage(int iter, double obj, double final_eps)
+{
+	// the current stage converged: report its solution and tighten eps
+	info("+");
+	if (telemetry)
+	{
+		if (cudaSolver)
+		{
+			cudaSolver->fetch_vectors(G, alpha, alpha_status, l);
+			obj = 0;
+			for (int i = 0; i < l; i++)
+				obj += alpha[i] * (G[i] + p[i]) / 2;
+		}
+		int prev_phase = enter_phase(PHASE_RHO);
+		telemetry->rho = calculate_rho();
+		enter_phase(prev_phase);
+		telemetry->obj = obj;
+		telemetry->eps = eps;
+		report_telemetry(TELEMETRY_STAGE, iter);
+	}
+	eps = max(eps / 10, final_eps);
+	if (cudaSolver)
+		cudaSolver->set_eps(eps);
+	unshrink = false;	// do_shrinking unshrinks once more near the new eps
 }
 
 // return 1 if already optimal, return 0 otherwise
@@ -838,46 +1512,33 @@ int Solver::select_working_set(int &out_i, int &out_j)
 	//    (if quadratic coefficeint <= 0, replace it with tau)
 	//    -y_j*grad(f)_j < -y_i*grad(f)_i, j in I_low(\alpha)
 
-	double Gmax = -INF;
-	double Gmax2 = -INF;
-	int Gmax_idx = -1;
-	int Gmin_idx = -1;
-	double obj_diff_min = INF;
-
-	for (int t = 0; t < active_size; t++)
-		if (y[t] == +1)
-		{
-		if (!is_upper_bound(t))
-			if (-G[t] >= Gmax)
-			{
-			Gmax = -G[t];
-			Gmax_idx = t;
-			}
-		}
-		else
-		{
-			if (!is_lower_bound(t))
-				if (G[t] >= Gmax)
-				{
-				Gmax = G[t];
-				Gmax_idx = t;
-				}
-		}
+	ArgMax<double> max_i;
+	if (fused_i_valid)
+		max_i = fused_i;
+	else
+	{
+		max_i.init(-INF);
+		max_i = host_reduce(active_size, max_i, [&](int t, ArgMax<double> &r) { fold_i(t, r); });
+	}
+	fused_i_valid = false;
+	double Gmax = max_i.value;
 
-	int i = Gmax_idx;
+	int i = max_i.idx;
 	const Qfloat *Q_i = NULL;
 	if (i != -1) // NULL Q_i not accessed: Gmax=-INF if i=-1
 		Q_i = Q->get_Q(i, active_size);
 
-	for (int j = 0; j < active_size; j++)
+	SelectJ init_j;
+	init_j.Gmax2.init(-INF);
+	init_j.obj_diff.init(INF);
+	SelectJ min_j = host_reduce(active_size, init_j, [&](int j, SelectJ &r)
 	{
 		if (y[j] == +1)
 		{
 			if (!is_lower_bound(j))
 			{
 				double grad_diff = Gmax + G[j];
-				if (G[j] >= Gmax2)
-					Gmax2 = G[j];
+				r.Gmax2.update(G[j]);
 				if (grad_diff > 0)
 				{
 					double obj_diff;
@@ -887,11 +1548,7 @@ int Solver::select_working_set(int &out_i, int &out_j)
 					else
 						obj_diff = -(grad_diff*grad_diff) / TAU;
 
-					if (obj_diff <= obj_diff_min)
-					{
-						Gmin_idx = j;
-						obj_diff_min = obj_diff;
-					}
+					r.obj_diff.update(obj_diff, j);
 				}
 			}
 		}
@@ -900,8 +1557,7 @@ int Solver::select_working_set(int &out_i, int &out_j)
 			if (!is_upper_bound(j))
 			{
 				double grad_diff = Gmax - G[j];
-				if (-G[j] >= Gmax2)
-					Gmax2 = -G[j];
+				r.Gmax2.update(-G[j]);
 				if (grad_diff > 0)
 				{
 					double obj_diff;
@@ -911,21 +1567,18 @@ int Solver::select_working_set(int &out_i, int &out_j)
 					else
 						obj_diff = -(grad_diff*grad_diff) / TAU;
 
-					if (obj_diff <= obj_diff_min)
-					{
-						Gmin_idx = j;
-						obj_diff_min = obj_diff;
-					}
+					r.obj_diff.update(obj_diff, j);
 				}
 			}
 		}
-	}
+	});
 
-	if (Gmax + Gmax2 < eps)
+	kkt_gap = Gmax + min_j.Gmax2.value;
+	if (kkt_gap < eps)
 		return 1;
 
-	out_i = Gmax_idx;
-	out_j = Gmin_idx;
+	out_i = max_i.idx;
+	out_j = min_j.obj_diff.idx;
 	return 0;
 }
 
@@ -952,6 +1605,7 @@ bool Solver::be_shrunk(int i, double Gmax1, double Gmax2)
 void Solver::do_shrinking()
 {
 	int i;
+	fused_i_valid = false;	// the active set is about to change
 	double Gmax1 = -INF;		// max { -y_i * grad(f)_i | i in I_up(\alpha) }
 	double Gmax2 = -INF;		// max { y_i * grad(f)_i | i in I_low(\alpha) }
 
@@ -994,6 +1648,7 @@ void Solver::do_shrinking()
 		info("*");
 	}
 
+	int shrunk_from = active_size;
 	for (i = 0; i < active_size; i++)
 		if (be_shrunk(i, Gmax1, Gmax2))
 		{
@@ -1008,6 +1663,9 @@ void Solver::do_shrinking()
 			active_size--;
 		}
 		}
+
+	if (param->compact_cache && active_size < shrunk_from)
+		Q->truncate_cache(active_size);
 }
 
 double Solver::calculate_rho()
@@ -1059,13 +1717,37 @@ public:
 	Solver_NU() {}
 	void Solve(int l, const QMatrix& Q, const double *p, const schar *y,
 		double *alpha, double Cp, double Cn, double eps,
-		SolutionInfo* si, int shrinking)
+		SolutionInfo* si, int shrinking, const svm_parameter *param)
 	{
 		this->si = si;
-		Solver::Solve(l, Q, p, y, alpha, Cp, Cn, eps, si, shrinking);
+		Solver::Solve(l, Q, p, y, alpha, Cp, Cn, eps, si, shrinking, param);
 	}
 private:
 	SolutionInfo *si;
+	SelectNuI fused_nu_i;
+	void fold_nu_i(int t, SelectNuI &r)
+	{
+		if (y[t] == +1)
+		{
+			if (!is_upper_bound(t))
+				r.Gmaxp.update(-G[t], t);
+		}
+		else
+		{
+			if (!is_lower_bound(t))
+				r.Gmaxn.update(G[t], t);
+		}
+	}
+	void begin_fused_i()
+	{
+		fused_nu_i.Gmaxp.init(-INF);
+		fused_nu_i.Gmaxn.init(-INF);
+	}
+	void fuse_i(int from, int to)
+	{
+		for (int t = from; t < to; t++)
+			fold_nu_i(t, fused_nu_i);
+	}
 	int select_working_set(int &i, int &j);
 	double calculate_rho();
 	bool be_shrunk(int i, double Gmax1, double Gmax2, double Gmax3, double Gmax4);
@@ -1081,39 +1763,21 @@ int Solver_NU::select_working_set(int &out_i, int &out_j)
 	//    (if quadratic coefficeint <= 0, replace it with tau)
 	//    -y_j*grad(f)_j < -y_i*grad(f)_i, j in I_low(\alpha)
 
-	double Gmaxp = -INF;
-	double Gmaxp2 = -INF;
-	int Gmaxp_idx = -1;
-
-	double Gmaxn = -INF;
-	double Gmaxn2 = -INF;
-	int Gmaxn_idx = -1;
-
-	int Gmin_idx = -1;
-	double obj_diff_min = INF;
-
-	for (int t = 0; t < active_size; t++)
-		if (y[t] == +1)
-		{
-		if (!is_upper_bound(t))
-			if (-G[t] >= Gmaxp)
-			{
-			Gmaxp = -G[t];
-			Gmaxp_idx = t;
-			}
-		}
-		else
-		{
-			if (!is_lower_bound(t))
-				if (G[t] >= Gmaxn)
-				{
-				Gmaxn = G[t];
-				Gmaxn_idx = t;
-				}
-		}
+	SelectNuI max_i;
+	if (fused_i_valid)
+		max_i = fused_nu_i;
+	else
+	{
+		max_i.Gmaxp.init(-INF);
+		max_i.Gmaxn.init(-INF);
+		max_i = host_reduce(active_size, max_i, [&](int t, SelectNuI &r) { fold_nu_i(t, r); });
+	}
+	fused_i_valid = false;
+	double Gmaxp = max_i.Gmaxp.value;
+	double Gmaxn = max_i.Gmaxn.value;
 
-	int ip = Gmaxp_idx;
-	int in = Gmaxn_idx;
+	int ip = max_i.Gmaxp.idx;
+	int in = max_i.Gmaxn.idx;
 	const Qfloat *Q_ip = NULL;
 	const Qfloat *Q_in = NULL;
 	if (ip != -1) // NULL Q_ip not accessed: Gmaxp=-INF if ip=-1
@@ -1121,15 +1785,18 @@ int Solver_NU::select_working_set(int &out_i, int &out_j)
 	if (in != -1)
 		Q_in = Q->get_Q(in, active_size);
 
-	for (int j = 0; j < active_size; j++)
+	SelectNuJ init_j;
+	init_j.Gmaxp2.init(-INF);
+	init_j.Gmaxn2.init(-INF);
+	init_j.obj_diff.init(INF);
+	SelectNuJ min_j = host_reduce(active_size, init_j, [&](int j, SelectNuJ &r)
 	{
 		if (y[j] == +1)
 		{
 			if (!is_lower_bound(j))
 			{
 				double grad_diff = Gmaxp + G[j];
-				if (G[j] >= Gmaxp2)
-					Gmaxp2 = G[j];
+				r.Gmaxp2.update(G[j]);
 				if (grad_diff > 0)
 				{
 					double obj_diff;
@@ -1139,11 +1806,7 @@ int Solver_NU::select_working_set(int &out_i, int &out_j)
 					else
 						obj_diff = -(grad_diff*grad_diff) / TAU;
 
-					if (obj_diff <= obj_diff_min)
-					{
-						Gmin_idx = j;
-						obj_diff_min = obj_diff;
-					}
+					r.obj_diff.update(obj_diff, j);
 				}
 			}
 		}
@@ -1152,8 +1815,7 @@ int Solver_NU::select_working_set(int &out_i, int &out_j)
 			if (!is_upper_bound(j))
 			{
 				double grad_diff = Gmaxn - G[j];
-				if (-G[j] >= Gmaxn2)
-					Gmaxn2 = -G[j];
+				r.Gmaxn2.update(-G[j]);
 				if (grad_diff > 0)
 				{
 					double obj_diff;
@@ -1163,23 +1825,21 @@ int Solver_NU::select_working_set(int &out_i, int &out_j)
 					else
 						obj_diff = -(grad_diff*grad_diff) / TAU;
 
-					if (obj_diff <= obj_diff_min)
-					{
-						Gmin_idx = j;
-						obj_diff_min = obj_diff;
-					}
+					r.obj_diff.update(obj_diff, j);
 				}
 			}
 		}
-	}
+	});
 
-	if (max(Gmaxp + Gmaxp2, Gmaxn + Gmaxn2) < eps)
+	kkt_gap = max(Gmaxp + min_j.Gmaxp2.value, Gmaxn + min_j.Gmaxn2.value);
+	if (kkt_gap < eps)
 		return 1;
 
+	int Gmin_idx = min_j.obj_diff.idx;
 	if (y[Gmin_idx] == +1)
-		out_i = Gmaxp_idx;
+		out_i = ip;
 	else
-		out_i = Gmaxn_idx;
+		out_i = in;
 	out_j = Gmin_idx;
 
 	return 0;
@@ -1211,6 +1871,7 @@ void Solver_NU::do_shrinking()
 	double Gmax2 = -INF;	// max { y_i * grad(f)_i | y_i = +1, i in I_low(\alpha) }
 	double Gmax3 = -INF;	// max { -y_i * grad(f)_i | y_i = -1, i in I_up(\alpha) }
 	double Gmax4 = -INF;	// max { y_i * grad(f)_i | y_i = -1, i in I_low(\alpha) }
+	fused_i_valid = false;	// the active set is about to change
 
 	// find maximal violating pair first
 	int i;
@@ -1241,6 +1902,7 @@ void Solver_NU::do_shrinking()
 		active_size = l;
 	}
 
+	int shrunk_from = active_size;
 	for (i = 0; i < active_size; i++)
 		if (be_shrunk(i, Gmax1, Gmax2, Gmax3, Gmax4))
 		{
@@ -1255,6 +1917,9 @@ void Solver_NU::do_shrinking()
 			active_size--;
 		}
 		}
+
+	if (param->compact_cache && active_size < shrunk_from)
+		Q->truncate_cache(active_size);
 }
 
 double Solver_NU::calculate_rho()
@@ -1307,6 +1972,139 @@ double Solver_NU::calculate_rho()
 	return (r1 - r2) / 2;
 }
 
+//
+// Kernel rows of a two-class subproblem, shared by the SVC_Q of its probability folds
+// (svm_binary_svc_probability) and of its final model.  They index the same rows of
+// prob->x, so a row computed for one of them serves the others.  A row is computed
+// whole by the first solver that asks for it, while the table is within its size,
+// and is only read after that; a solver that finds a row missing computes its values
+// itself, so the results are the same as without the table.
+//
+struct table_row
+{
+	const svm_node *x;
+	int row;
+};
+
+static int compare_table_row(const void *a, const void *b)
+{
+	const svm_node *x = ((const table_row *)a)->x, *y = ((const table_row *)b)->x;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+class KernelTable : public Kernel
+{
+public:
+	KernelTable(const svm_problem& prob, const svm_parameter& param, long int size)
+		:Kernel(prob.l, prob.x, param), l(prob.l), kernel_type(param.kernel_type), degree(param.degree),
+		gamma(param.gamma), coef0(param.coef0), index_compression(param.index_compression)
+	{
+		max_rows = (int)min((long int)l, size / ((long int)sizeof(Qfloat)*l));
+		nr_rows = 0;
+		data = new Qfloat *[l];
+		state = new std::atomic<int>[l];
+		for (int r = 0; r < l; r++)
+		{
+			data[r] = NULL;
+			state[r] = ROW_EMPTY;
+		}
+		rows = Malloc(table_row, l);
+		for (int r = 0; r < l; r++)
+		{
+			rows[r].x = prob.x[r];
+			rows[r].row = r;
+		}
+		qsort(rows, l, sizeof(table_row), compare_table_row);
+	}
+
+	// true if the kernel of param is the one of the table
+	bool same_kernel(const svm_parameter& param) const
+	{
+		return param.kernel_type == kernel_type && param.degree == degree && param.gamma == gamma &&
+			param.coef0 == coef0 && param.index_compression == index_compression;
+	}
+
+	// row[i] = the row of the table holding x[i]; false if one of them is not in the table
+	bool find_rows(svm_node * const *x, int n, int *row) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			table_row key;
+			key.x = x[i];
+			const table_row *found = (const table_row *)bsearch(&key, rows, l, sizeof(table_row), compare_table_row);
+			if (found == NULL)
+				return false;
+			row[i] = found->row;
+		}
+		return true;
+	}
+
+	// K(r,0..l), computed now if the table has room for it; NULL if not in the table
+	Qfloat *get_Q(int r, int len) const
+	{
+		int s = state[r].load(std::memory_order_acquire);
+		if (s == ROW_READY)
+			return data[r];
+		if (s != ROW_EMPTY || !state[r].compare_exchange_strong(s, ROW_BUSY))
+			return NULL;	// being computed by another solver
+		if (nr_rows.fetch_add(1) >= max_rows)
+		{
+			state[r].store(ROW_NONE);
+			return NULL;
+		}
+		Qfloat *q = new Qfloat[l];
+		for (int c = 0; c < l; c++)
+			q[c] = (Qfloat)(this->*kernel_function)(r, c);
+		data[r] = q;
+		state[r].store(ROW_READY, std::memory_order_release);
+		return q;
+	}
+
+	// K(r,0..l) if it is in the table already, NULL otherwise
+	const Qfloat *peek_Q(int r) const
+	{
+		return state[r].load(std::memory_order_acquire) == ROW_READY ? data[r] : NULL;
+	}
+
+	void get_Q_subset(int i, const int *idx, int n, Qfloat *out) const
+	{
+		for (int t = 0; t < n; t++)
+			out[t] = (Qfloat)(this->*kernel_function)(i, idx[t]);
+	}
+
+	double *get_QD() const
+	{
+		return NULL;	// the table is not solved
+	}
+
+	void swap_index(int i, int j) const {}	// rows are looked up, never swapped
+
+	~KernelTable()
+	{
+		for (int r = 0; r < l; r++)
+			delete[] data[r];
+		delete[] data;
+		delete[] state;
+		free(rows);
+	}
+private:
+	enum { ROW_EMPTY, ROW_BUSY, ROW_READY, ROW_NONE };	// ROW_NONE: over max_rows
+	int l;
+	const int kernel_type;
+	const int degree;
+	const double gamma;
+	const double coef0;
+	const int index_compression;
+	int max_rows;
+	mutable std::atomic<int> nr_rows;	// rows taken, including those over max_rows
+	Qfloat **data;
+	std::atomic<int> *state;
+	table_row *rows;	// sorted by x
+};
+
+// the table of the subproblem this thread trains for, see svm_binary_svc_probability()
+static thread_local const KernelTable *kernel_table;
+
 //
 // Q matrices for various formulations
 //
@@ -1317,50 +2115,143 @@ public:
 		:Kernel(prob.l, prob.x, param)
 	{
 		clone(y, y_, prob.l);
-		cache = new Cache(prob.l, (long int)(param.cache_size*(1 << 20)));
+		bf16 = (param.cache_precision == CACHE_BF16);
+		cache = new Cache(prob.l, (long int)(param.cache_size*(1 << 20)), bf16 ? sizeof(Qbf16) : sizeof(Qfloat));
+		buffer[0] = bf16 ? new Qfloat[prob.l] : NULL;
+		buffer[1] = bf16 ? new Qfloat[prob.l] : NULL;
+		next_buffer = 0;
 		if (cudaSolver == nullptr) { // CUDA INTEGRATION - cuda device will allocate its own QD vector
 			QD = new double[prob.l];
 			for (int i = 0; i < prob.l; i++)
-				QD[i] = (this->*kernel_function)(i, i);
+				QD[i] = bf16 ? to_Qfloat(to_bf16((Qfloat)(this->*kernel_function)(i, i))) : (this->*kernel_function)(i, i);
 		}
 		else
 			QD = nullptr;
+		table = NULL;
+		row = NULL;
+		if (kernel_table && cudaSolver == nullptr && kernel_table->same_kernel(param))
+		{
+			row = new int[prob.l];
+			if (kernel_table->find_rows(prob.x, prob.l, row))
+				table = kernel_table;
+			else
+			{
+				delete[] row;
+				row = NULL;
+			}
+		}
 	}
 
 	Qfloat *get_Q(int i, int len) const
 	{
-		Qfloat *data;
-		int start, j;
-		if ((start = cache->get_data(i, &data, len)) < len)
+		int start;
+		if (bf16)
 		{
-			for (j = start; j < len; j++)
-				data[j] = (Qfloat)(y[i] * y[j] * (this->*kernel_function)(i, j));
+			Qbf16 *data = get_Q_lazy_bf16(i, len, start);
+			fill_Q(i, data, start, len);
+			Qfloat *buf = buffer[next_buffer];
+			next_buffer = 1 - next_buffer;
+			for (int j = 0; j < len; j++)
+				buf[j] = to_Qfloat(data[j]);
+			return buf;
 		}
+		Qfloat *data = get_Q_lazy(i, len, start);
+		fill_Q(i, data, start, len);
 		return data;
 	}
 
+	Qfloat *get_Q_lazy(int i, int len, int &start) const
+	{
+		Qfloat *data;
+		start = cache->get_data(i, &data, len);
+		return data;
+	}
+
+	bool is_bf16_cache() const { return bf16; }
+
+	Qbf16 *get_Q_lazy_bf16(int i, int len, int &start) const
+	{
+		Qbf16 *data;
+		start = cache->get_data(i, &data, len);
+		return data;
+	}
+
+	// y is +-1, so y[i]*y[j] times a kernel value rounded to Qfloat is rounded exactly
+	// like the product, and a row of the table gives the column the kernel would
+	void fill_Q(int i, Qfloat *data, int from, int to) const
+	{
+		const Qfloat *k = table ? table->get_Q(row[i], 0) : NULL;
+		if (k)
+			for (int j = from; j < to; j++)
+				data[j] = y[i] * y[j] * k[row[j]];
+		else
+			for (int j = from; j < to; j++)
+				data[j] = (Qfloat)(y[i] * y[j] * (this->*kernel_function)(i, j));
+	}
+
+	void fill_Q(int i, Qbf16 *data, int from, int to) const
+	{
+		const Qfloat *k = table ? table->get_Q(row[i], 0) : NULL;
+		if (k)
+			for (int j = from; j < to; j++)
+				data[j] = to_bf16(y[i] * y[j] * k[row[j]]);
+		else
+			for (int j = from; j < to; j++)
+				data[j] = to_bf16((Qfloat)(y[i] * y[j] * (this->*kernel_function)(i, j)));
+	}
+
+	void get_Q_subset(int i, const int *idx, int n, Qfloat *out) const
+	{
+		// the rows of inactive variables are needed once, so they are not added to the table
+		const Qfloat *k = table ? table->peek_Q(row[i]) : NULL;
+		for (int t = 0; t < n; t++)
+		{
+			Qfloat q = k ? y[i] * y[idx[t]] * k[row[idx[t]]] : (Qfloat)(y[i] * y[idx[t]] * (this->*kernel_function)(i, idx[t]));
+			out[t] = bf16 ? to_Qfloat(to_bf16(q)) : q;
+		}
+	}
+
 	double *get_QD() const
 	{
 		return QD;
 	}
 
+	double get_cache_hit_rate() const
+	{
+		return cache->hit_rate();
+	}
+
+	void truncate_cache(int len) const
+	{
+		cache->truncate(len);
+	}
+
 	void swap_index(int i, int j) const
 	{
 		cache->swap_index(i, j);
 		Kernel::swap_index(i, j);
 		swap(y[i], y[j]);
 		swap(QD[i], QD[j]);
+		if (row) swap(row[i], row[j]);
 	}
 
 	~SVC_Q()
 	{
 		delete[] y;
 		delete cache;
+		delete[] buffer[0];
+		delete[] buffer[1];
 		delete[] QD;
+		delete[] row;
 	}
 private:
 	schar *y;
 	Cache *cache;
+	const KernelTable *table;	// kernel rows shared with the other solvers of the subproblem, or NULL
+	int *row;	// row[i]: the row of x[i] in table
+	bool bf16;	// cache holds Qbf16 columns
+	mutable int next_buffer;
+	Qfloat *buffer[2];	// get_Q results converted from Qbf16
 	double *QD;
 };
 
@@ -1370,11 +2261,15 @@ public:
 	ONE_CLASS_Q(const svm_problem& prob, const svm_parameter& param)
 		:Kernel(prob.l, prob.x, param)
 	{
-		cache = new Cache(prob.l, (long int)(param.cache_size*(1 << 20)));
+		bf16 = (param.cache_precision == CACHE_BF16);
+		cache = new Cache(prob.l, (long int)(param.cache_size*(1 << 20)), bf16 ? sizeof(Qbf16) : sizeof(Qfloat));
+		buffer[0] = bf16 ? new Qfloat[prob.l] : NULL;
+		buffer[1] = bf16 ? new Qfloat[prob.l] : NULL;
+		next_buffer = 0;
 		if (cudaSolver == nullptr) { // CUDA INTEGRATION - cude device will allocate its own QD vector
 			QD = new double[prob.l];
 			for (int i = 0; i < prob.l; i++)
-				QD[i] = (this->*kernel_function)(i, i);
+				QD[i] = bf16 ? to_Qfloat(to_bf16((Qfloat)(this->*kernel_function)(i, i))) : (this->*kernel_function)(i, i);
 		}
 		else
 			QD = nullptr;
@@ -1382,21 +2277,74 @@ public:
 
 	Qfloat *get_Q(int i, int len) const
 	{
-		Qfloat *data;
-		int start, j;
-		if ((start = cache->get_data(i, &data, len)) < len)
+		int start;
+		if (bf16)
 		{
-			for (j = start; j < len; j++)
-				data[j] = (Qfloat)(this->*kernel_function)(i, j);
+			Qbf16 *data = get_Q_lazy_bf16(i, len, start);
+			fill_Q(i, data, start, len);
+			Qfloat *buf = buffer[next_buffer];
+			next_buffer = 1 - next_buffer;
+			for (int j = 0; j < len; j++)
+				buf[j] = to_Qfloat(data[j]);
+			return buf;
 		}
+		Qfloat *data = get_Q_lazy(i, len, start);
+		fill_Q(i, data, start, len);
 		return data;
 	}
 
+	Qfloat *get_Q_lazy(int i, int len, int &start) const
+	{
+		Qfloat *data;
+		start = cache->get_data(i, &data, len);
+		return data;
+	}
+
+	bool is_bf16_cache() const { return bf16; }
+
+	Qbf16 *get_Q_lazy_bf16(int i, int len, int &start) const
+	{
+		Qbf16 *data;
+		start = cache->get_data(i, &data, len);
+		return data;
+	}
+
+	void fill_Q(int i, Qfloat *data, int from, int to) const
+	{
+		for (int j = from; j < to; j++)
+			data[j] = (Qfloat)(this->*kernel_function)(i, j);
+	}
+
+	void fill_Q(int i, Qbf16 *data, int from, int to) const
+	{
+		for (int j = from; j < to; j++)
+			data[j] = to_bf16((Qfloat)(this->*kernel_function)(i, j));
+	}
+
+	void get_Q_subset(int i, const int *idx, int n, Qfloat *out) const
+	{
+		for (int t = 0; t < n; t++)
+		{
+			Qfloat q = (Qfloat)(this->*kernel_function)(i, idx[t]);
+			out[t] = bf16 ? to_Qfloat(to_bf16(q)) : q;
+		}
+	}
+
 	double *get_QD() const
 	{
 		return QD;
 	}
 
+	double get_cache_hit_rate() const
+	{
+		return cache->hit_rate();
+	}
+
+	void truncate_cache(int len) const
+	{
+		cache->truncate(len);
+	}
+
 	void swap_index(int i, int j) const
 	{
 		cache->swap_index(i, j);
@@ -1407,10 +2355,15 @@ public:
 	~ONE_CLASS_Q()
 	{
 		delete cache;
+		delete[] buffer[0];
+		delete[] buffer[1];
 		delete[] QD;
 	}
 private:
 	Cache *cache;
+	bool bf16;	// cache holds Qbf16 columns
+	mutable int next_buffer;
+	Qfloat *buffer[2];	// get_Q results converted from Qbf16
 	double *QD;
 };
 
@@ -1421,7 +2374,8 @@ public:
 		:Kernel(prob.l, prob.x, param)
 	{
 		l = prob.l;
-		cache = new Cache(l, (long int)(param.cache_size*(1 << 20)));
+		bf16 = (param.cache_precision == CACHE_BF16);
+		cache = new Cache(l, (long int)(param.cache_size*(1 << 20)), bf16 ? sizeof(Qbf16) : sizeof(Qfloat));
 		if (cudaSolver == nullptr) // CUDA INTEGRATION - cuda device will allocate its own QD vector
 			QD = new double[2 * l]; 
 		else
@@ -1435,7 +2389,7 @@ public:
 			index[k] = k;
 			index[k + l] = k;
 			if (cudaSolver == nullptr) { // CUDA INTEGRATION
-				QD[k] = (this->*kernel_function)(k, k);
+				QD[k] = bf16 ? to_Qfloat(to_bf16((Qfloat)(this->*kernel_function)(k, k))) : (this->*kernel_function)(k, k);
 				QD[k + l] = QD[k];
 			}
 		}
@@ -1453,21 +2407,35 @@ public:
 
 	Qfloat *get_Q(int i, int len) const
 	{
-		Qfloat *data;
 		int j, real_i = index[i];
+		if (bf16)
+		{
+			Qbf16 *data;
+			if (cache->get_data(real_i, &data, l) < l)
+			{
+				for (j = 0; j < l; j++)
+					data[j] = to_bf16((Qfloat)(this->*kernel_function)(real_i, j));
+			}
+			return reorder(i, data, len);
+		}
+
+		Qfloat *data;
 		if (cache->get_data(real_i, &data, l) < l)
 		{
 			for (j = 0; j < l; j++) 
 				data[j] = (Qfloat)(this->*kernel_function)(real_i, j);
 		}
-
-		// reorder and copy
-		Qfloat *buf = buffer[next_buffer];
-		next_buffer = 1 - next_buffer;
-		schar si = sign[i];
-		for (j = 0; j < len; j++)
-			buf[j] = (Qfloat)si * (Qfloat)sign[j] * data[index[j]];
-		return buf;
+		return reorder(i, data, len);
+	}
+
+	void get_Q_subset(int i, const int *idx, int n, Qfloat *out) const
+	{
+		int real_i = index[i];
+		for (int t = 0; t < n; t++)
+		{
+			Qfloat q = (Qfloat)sign[i] * (Qfloat)sign[idx[t]] * (Qfloat)(this->*kernel_function)(real_i, index[idx[t]]);
+			out[t] = bf16 ? to_Qfloat(to_bf16(q)) : q;
+		}
 	}
 
 	double *get_QD() const
@@ -1475,6 +2443,11 @@ public:
 		return QD;
 	}
 
+	double get_cache_hit_rate() const
+	{
+		return cache->hit_rate();
+	}
+
 	~SVR_Q()
 	{
 		delete cache;
@@ -1487,11 +2460,23 @@ public:
 private:
 	int l;
 	Cache *cache;
+	bool bf16;	// cache holds Qbf16 columns
 	schar *sign;
 	int *index;
 	mutable int next_buffer;
 	Qfloat *buffer[2];
 	double *QD;
+
+	template <class T> Qfloat *reorder(int i, const T *data, int len) const
+	{
+		// reorder and copy
+		Qfloat *buf = buffer[next_buffer];
+		next_buffer = 1 - next_buffer;
+		schar si = sign[i];
+		for (int j = 0; j < len; j++)
+			buf[j] = (Qfloat)si * (Qfloat)sign[j] * to_Qfloat(data[index[j]]);
+		return buf;
+	}
 };
 
 //
@@ -1516,7 +2501,7 @@ static void solve_c_svc(
 
 	Solver s;
 	s.Solve(l, SVC_Q(*prob, *param, y), minus_ones, y,
-		alpha, Cp, Cn, param->eps, si, param->shrinking);
+		alpha, Cp, Cn, param->eps, si, param->shrinking, param);
 
 	double sum_alpha = 0;
 	for (i = 0; i < l; i++)
@@ -1570,7 +2555,7 @@ static void solve_nu_svc(
 
 	Solver_NU s;
 	s.Solve(l, SVC_Q(*prob, *param, y), zeros, y,
-		alpha, 1.0, 1.0, param->eps, si, param->shrinking);
+		alpha, 1.0, 1.0, param->eps, si, param->shrinking, param);
 	double r = si->r;
 
 	info("C = %f\n", 1 / r);
@@ -1613,7 +2598,7 @@ static void solve_one_class(
 
 	Solver s;
 	s.Solve(l, ONE_CLASS_Q(*prob, *param), zeros, ones,
-		alpha, 1.0, 1.0, param->eps, si, param->shrinking);
+		alpha, 1.0, 1.0, param->eps, si, param->shrinking, param);
 
 	delete[] zeros;
 	delete[] ones;
@@ -1642,7 +2627,7 @@ static void solve_epsilon_svr(
 
 	Solver s;
 	s.Solve(2 * l, SVR_Q(*prob, *param), linear_term, y,
-		alpha2, param->C, param->C, param->eps, si, param->shrinking);
+		alpha2, param->C, param->C, param->eps, si, param->shrinking, param);
 
 	double sum_alpha = 0;
 	for (i = 0; i < l; i++)
@@ -1683,7 +2668,7 @@ static void solve_nu_svr(
 
 	Solver_NU s;
 	s.Solve(2 * l, SVR_Q(*prob, *param), linear_term, y,
-		alpha2, C, C, param->eps, si, param->shrinking);
+		alpha2, C, C, param->eps, si, param->shrinking, param);
 
 	info("epsilon = %f\n", -si->r);
 
@@ -1704,40 +2689,356 @@ struct decision_function
 	double rho;
 };
 
+//
+// Row reordering for locality: rows are sorted by a two-value MinHash of
+// their feature indices, so rows sharing many features end up next to each
+// other, and are copied in that order into one contiguous x_space.  Kernel
+// columns then walk neighbouring memory in Kernel::dot.
+//
+static inline uint32_t hash_index(int index, uint32_t seed)
+{
+	// murmur3 finalizer
+	uint32_t h = (uint32_t)index ^ seed;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+struct minhash_key
+{
+	uint64_t key;
+	int row;
+};
+
+static int compare_minhash_key(const void *a, const void *b)
+{
+	const minhash_key *p = (const minhash_key *)a, *q = (const minhash_key *)b;
+	if (p->key != q->key)
+		return p->key < q->key ? -1 : 1;
+	return p->row - q->row;	// keep the input order of equal keys
+}
+
+// returns order[] with prob->x[order[k]] being row k of *reordered;
+// reordered->x points into the returned x_space
+static svm_node *reorder_rows(const svm_problem *prob, int *order, svm_problem *reordered)
+{
+	int l = prob->l;
+	minhash_key *keys = Malloc(minhash_key, l);
+	size_t elements = 0;
+	for (int i = 0; i < l; i++)
+	{
+		uint32_t min1 = UINT32_MAX, min2 = UINT32_MAX;
+		const svm_node *x = prob->x[i];
+		for (; x->index != -1; x++)
+		{
+			min1 = min(min1, hash_index(x->index, 0x9e3779b9));
+			min2 = min(min2, hash_index(x->index, 0x7f4a7c15));
+		}
+		elements += x - prob->x[i] + 1;
+		keys[i].key = ((uint64_t)min1 << 32) | min2;
+		keys[i].row = i;
+	}
+	qsort(keys, l, sizeof(minhash_key), compare_minhash_key);
+
+	svm_node *x_space = Malloc(svm_node, elements);
+	reordered->l = l;
+	reordered->y = Malloc(double, l);
+	reordered->x = Malloc(svm_node *, l);
+	size_t j = 0;
+	for (int k = 0; k < l; k++)
+	{
+		int i = keys[k].row;
+		order[k] = i;
+		reordered->y[k] = prob->y[i];
+		reordered->x[k] = &x_space[j];
+		const svm_node *x = prob->x[i];
+		do
+			x_space[j++] = *x;
+		while ((x++)->index != -1);
+	}
+	free(keys);
+	return x_space;
+}
+
+//
+// Approximate training (param->approx_landmarks = m > 0) for C-SVC
+//
+// With m landmark rows z sampled from the subproblem and K_mm = L L^T, the
+// Nystrom feature map phi(x) = L^{-1} [K(x,z_1) ... K(x,z_m)] gives
+// phi(x)'phi(y) ~= K(x,y).  A linear SVM with a bias feature is solved in phi
+// space by dual coordinate descent (Hsieh et al., ICML 2008); w maps back to
+// the coefficients beta = L^{-T} w of K(.,z), so the landmarks are the SVs of
+// an ordinary kernel model.  Time is O(l m^2 + l m #iter), memory O(l m).
+//
+#define APPROX_STREAM (-1)	// Random stream of the landmark sample and the coordinate order
+#define DCD_MAX_ITER 1000
+
+static decision_function svm_train_approx(
+	const svm_problem *prob, const svm_parameter *param,
+	double Cp, double Cn)
+{
+	int l = prob->l;
+	int m = min(param->approx_landmarks, l);
+	int i, j, k;
+	double start_time = wall_time();
+	Random rnd(param->seed, APPROX_STREAM);
+
+	// landmarks: the first m of a partial shuffle
+	int *index = Malloc(int, l);
+	for (i = 0; i < l; i++)
+		index[i] = i;
+	for (i = 0; i < m; i++)
+		swap(index[i], index[i + rnd.next(l - i)]);
+
+	// lower Cholesky factor of K_mm; a small ridge keeps it positive definite
+	// when landmarks are duplicates or the kernel is of low rank
+	double *L = Malloc(double, (size_t)m * m);
+#pragma omp parallel for private(j) schedule(dynamic)
+	for (i = 0; i < m; i++)
+		for (j = 0; j <= i; j++)
+			L[(size_t)i * m + j] = Kernel::k_function(prob->x[index[i]], prob->x[index[j]], *param);
+	double trace = 0;
+	for (i = 0; i < m; i++)
+		trace += L[(size_t)i * m + i];
+	double ridge = 1e-10 * max(trace / m, 1.0);
+	int rank_deficient = 0;
+	for (j = 0; j < m; j++)
+	{
+		double *Lj = &L[(size_t)j * m];
+		double d = Lj[j];
+		for (k = 0; k < j; k++)
+			d -= Lj[k] * Lj[k];
+		if (d <= ridge)
+		{
+			d = ridge;
+			++rank_deficient;
+		}
+		Lj[j] = sqrt(d);
+#pragma omp parallel for private(k) schedule(static)
+		for (i = j + 1; i < m; i++)
+		{
+			double *Li = &L[(size_t)i * m];
+			double s = Li[j];
+			for (k = 0; k < j; k++)
+				s -= Li[k] * Lj[k];
+			Li[j] = s / Lj[j];
+		}
+	}
+
+	// phi of every row by forward substitution, stored in single precision
+	Qfloat *Z = Malloc(Qfloat, (size_t)l * m);
+	double *QD = Malloc(double, l);
+#pragma omp parallel private(i, j, k)
+	{
+		double *phi = Malloc(double, m);
+#pragma omp for schedule(dynamic, 64)
+		for (i = 0; i < l; i++)
+		{
+			double sq = 1;	// the bias feature
+			for (j = 0; j < m; j++)
+			{
+				const double *Lj = &L[(size_t)j * m];
+				double s = Kernel::k_function(prob->x[i], prob->x[index[j]], *param);
+				for (k = 0; k < j; k++)
+					s -= Lj[k] * phi[k];
+				phi[j] = s / Lj[j];
+				sq += phi[j] * phi[j];
+			}
+			for (j = 0; j < m; j++)
+				Z[(size_t)i * m + j] = (Qfloat)phi[j];
+			QD[i] = sq;
+		}
+		free(phi);
+	}
+	double map_time = wall_time() - start_time;
+
+	// dual coordinate descent for the L1-loss SVM, w[m] being the bias;
+	// with param->shrinking, bounded alphas unlikely to move are skipped as in
+	// the Solver, and all of them are checked again before stopping
+	double *w = Malloc(double, m + 1);
+	double *alpha = Malloc(double, l);
+	int *perm = Malloc(int, l);
+	for (j = 0; j <= m; j++)
+		w[j] = 0;
+	for (i = 0; i < l; i++)
+	{
+		alpha[i] = 0;
+		perm[i] = i;
+	}
+	int iter = 0;
+	int active_size = l;
+	double PGmax_old = INF, PGmin_old = -INF;
+	while (iter < DCD_MAX_ITER)
+	{
+		double PGmax = -INF, PGmin = INF;
+		for (i = 0; i < active_size; i++)
+			swap(perm[i], perm[i + rnd.next(active_size - i)]);
+		for (int s = 0; s < active_size; s++)
+		{
+			i = perm[s];
+			const Qfloat *Zi = &Z[(size_t)i * m];
+			double yi = prob->y[i];
+			double C = yi > 0 ? Cp : Cn;
+			double G = w[m];
+			for (j = 0; j < m; j++)
+				G += w[j] * Zi[j];
+			G = G * yi - 1;
+
+			double PG = 0;
+			if (alpha[i] == 0)
+			{
+				if (param->shrinking && G > PGmax_old)
+				{
+					swap(perm[s--], perm[--active_size]);
+					continue;
+				}
+				PG = min(G, 0.0);
+			}
+			else if (alpha[i] == C)
+			{
+				if (param->shrinking && G < PGmin_old)
+				{
+					swap(perm[s--], perm[--active_size]);
+					continue;
+				}
+				PG = max(G, 0.0);
+			}
+			else
+				PG = G;
+			PGmax = max(PGmax, PG);
+			PGmin = min(PGmin, PG);
+
+			if (fabs(PG) > TAU)
+			{
+				double old_alpha = alpha[i];
+				alpha[i] = min(max(alpha[i] - G / QD[i], 0.0), C);
+				double d = (alpha[i] - old_alpha) * yi;
+				for (j = 0; j < m; j++)
+					w[j] += d * Zi[j];
+				w[m] += d;
+			}
+		}
+		++iter;
+		if (PGmax - PGmin <= param->eps)
+		{
+			if (active_size == l)
+				break;
+			active_size = l;
+			PGmax_old = INF;
+			PGmin_old = -INF;
+			continue;
+		}
+		PGmax_old = PGmax <= 0 ? INF : PGmax;
+		PGmin_old = PGmin >= 0 ? -INF : PGmin;
+	}
+	if (iter >= DCD_MAX_ITER)
+		info("\nWARNING: reaching max number of iterations\n");
+
+	int nSV = 0, nBSV = 0;
+	for (i = 0; i < l; i++)
+		if (alpha[i] > 0)
+		{
+			++nSV;
+			if (alpha[i] >= (prob->y[i] > 0 ? Cp : Cn))
+				++nBSV;
+		}
+
+	// beta = L^{-T} w by back substitution, scattered to the landmark rows
+	decision_function f;
+	f.alpha = Malloc(double, l);
+	for (i = 0; i < l; i++)
+		f.alpha[i] = 0;
+	for (j = m - 1; j >= 0; j--)
+	{
+		double s = w[j];
+		for (k = j + 1; k < m; k++)
+			s -= L[(size_t)k * m + j] * w[k];
+		w[j] = s / L[(size_t)j * m + j];
+		f.alpha[index[j]] = w[j];
+	}
+	f.rho = -w[m];
+
+	info("approx: m = %d (%d rank deficient), #iter = %d, map %gs, total %gs\n",
+		m, rank_deficient, iter, map_time, wall_time() - start_time);
+	info("rho = %f, nSV = %d, nBSV = %d (of the linear problem)\n", f.rho, nSV, nBSV);
+
+	free(index);
+	free(L);
+	free(Z);
+	free(QD);
+	free(w);
+	free(alpha);
+	free(perm);
+	return f;
+}
+
 static decision_function svm_train_one(
 	const svm_problem *prob, const svm_parameter *param,
 	double Cp, double Cn)
 {
+	if (param->approx_landmarks > 0)
+		return svm_train_approx(prob, param, Cp, Cn);
+
+	Solver::SolutionInfo si;
+	si.start_time = wall_time();
 	double *alpha = Malloc(double, prob->l);
+
+	const svm_problem *train_prob = prob;
+	svm_problem reordered;
+	svm_node *reordered_space = NULL;
+	int *order = NULL;
+	if (param->reorder_rows)
+	{
+		order = Malloc(int, prob->l);
+		reordered_space = reorder_rows(prob, order, &reordered);
+		train_prob = &reordered;
+	}
+
 	if (param->cuda_flag == 1) { // CUDA INTEGRATION
 		if (param->svm_type == NU_SVC || param->svm_type == NU_SVR) {
-			cudaSolver = new CudaSolverNU(*prob, *param); // nu-solver
+			cudaSolver = new CudaSolverNU(*train_prob, *param); // nu-solver
 		} else {
-			cudaSolver = new CudaSolver(*prob, *param);  
+			cudaSolver = new CudaSolver(*train_prob, *param);  
 		}
 	}
-	Solver::SolutionInfo si;
 	switch (param->svm_type)
 	{
 	case C_SVC:
-		solve_c_svc(prob, param, alpha, &si, Cp, Cn);
+		solve_c_svc(train_prob, param, alpha, &si, Cp, Cn);
 		break;
 	case NU_SVC:
-		solve_nu_svc(prob, param, alpha, &si);
+		solve_nu_svc(train_prob, param, alpha, &si);
 		break;
 	case ONE_CLASS:
-		solve_one_class(prob, param, alpha, &si);
+		solve_one_class(train_prob, param, alpha, &si);
 		break;
 	case EPSILON_SVR:
-		solve_epsilon_svr(prob, param, alpha, &si);
+		solve_epsilon_svr(train_prob, param, alpha, &si);
 		break;
 	case NU_SVR:
-		solve_nu_svr(prob, param, alpha, &si);
+		solve_nu_svr(train_prob, param, alpha, &si);
 		break;
 	}
 	delete cudaSolver; cudaSolver = nullptr;
 	info("obj = %f, rho = %f\n", si.obj, si.rho);
 
+	if (order)
+	{
+		// map alpha back to the input order
+		double *reordered_alpha = alpha;
+		alpha = Malloc(double, prob->l);
+		for (int k = 0; k < prob->l; k++)
+			alpha[order[k]] = reordered_alpha[k];
+		free(reordered_alpha);
+		free(reordered.x);
+		free(reordered.y);
+		free(reordered_space);
+		free(order);
+	}
+
 	// output SVs
 
 	int nSV = 0;
@@ -1959,20 +3260,31 @@ static void multiclass_probability(int k, double **r, double *p)
 // Cross-validation decision values for probability estimates
 static void svm_binary_svc_probability(
 	const svm_problem *prob, const svm_parameter *param,
-	double Cp, double Cn, double& probA, double& probB)
+	double Cp, double Cn, double& probA, double& probB, int stream)
 {
 	int i;
 	int nr_fold = 5;
 	int *perm = Malloc(int, prob->l);
 	double *dec_values = Malloc(double, prob->l);
+	Random rnd(param->seed, stream);
 
 	// random shuffle
 	for (i = 0; i < prob->l; i++) perm[i] = i;
 	for (i = 0; i < prob->l; i++)
 	{
-		int j = i + rand() % (prob->l - i);
+		int j = i + rnd.next(prob->l - i);
 		swap(perm[i], perm[j]);
 	}
+	// the folds are independent, so train them concurrently; each thread
+	// has its own (null) cudaSolver, but the cuda device is not shared.
+	// The folds running at once split the cache, and share kernel_table
+	int nr_thread = 1;
+#ifdef _OPENMP
+	if (param->cuda_flag == 0 && !omp_in_parallel())
+		nr_thread = min(nr_fold, omp_get_max_threads());
+#endif
+	const KernelTable *table = kernel_table;
+#pragma omp parallel for schedule(dynamic, 1) if (param->cuda_flag == 0)
 	for (i = 0; i < nr_fold; i++)
 	{
 		int begin = i*prob->l / nr_fold;
@@ -2017,6 +3329,7 @@ static void svm_binary_svc_probability(
 		{
 			svm_parameter subparam = *param;
 			subparam.probability = 0;
+			subparam.cache_size = param->cache_size / nr_thread;
 			subparam.C = 1.0;
 			subparam.nr_weight = 2;
 			subparam.weight_label = Malloc(int, 2);
@@ -2025,7 +3338,10 @@ static void svm_binary_svc_probability(
 			subparam.weight_label[1] = -1;
 			subparam.weight[0] = Cp;
 			subparam.weight[1] = Cn;
+			const KernelTable *outer_table = kernel_table;
+			kernel_table = table;
 			struct svm_model *submodel = svm_train(&subprob, &subparam);
+			kernel_table = outer_table;
 			for (j = begin; j < end; j++)
 			{
 				svm_predict_values(submodel, prob->x[perm[j]], &(dec_values[perm[j]]));
@@ -2156,12 +3472,230 @@ static void svm_group_classes(const svm_problem *prob, int *nr_class_ret, int **
 //
 // Interface functions
 //
+//
+// Feature remapping: the feature indices of the training set are renumbered
+// 1..d by decreasing frequency, so anything sized by the largest index (the
+// device bitvectors, dense scratch rows) is sized by d instead.  The model
+// keeps the map and svm_predict_values applies it.
+//
+struct feature_count
+{
+	int index;
+	int count;
+};
+
+static int compare_int(const void *a, const void *b)
+{
+	int p = *(const int *)a, q = *(const int *)b;
+	return (p > q) - (p < q);
+}
+
+static int compare_feature_count(const void *a, const void *b)
+{
+	const feature_count *p = (const feature_count *)a, *q = (const feature_count *)b;
+	if (p->count != q->count)
+		return q->count - p->count;	// most frequent first
+	return (p->index > q->index) - (p->index < q->index);
+}
+
+static int compare_feature_index(const void *a, const void *b)
+{
+	return compare_int(&((const feature_count *)a)->index, &((const feature_count *)b)->index);
+}
+
+static void build_feature_lookup(svm_model *model)
+{
+	int n = model->nr_feature;
+	feature_count *by_index = Malloc(feature_count, max(n, 1));
+	for (int k = 0; k < n; k++)
+	{
+		by_index[k].index = model->feature_map[k];
+		by_index[k].count = k + 1;	// the new index
+	}
+	qsort(by_index, n, sizeof(feature_count), compare_feature_index);
+	model->feature_lookup = Malloc(int, max(n, 1));
+	for (int k = 0; k < n; k++)
+		model->feature_lookup[k] = by_index[k].count;
+	free(by_index);
+}
+
+static int compare_node_index(const void *a, const void *b)
+{
+	return compare_int(&((const svm_node *)a)->index, &((const svm_node *)b)->index);
+}
+
+// new index of input feature index, 0 if it was not seen in training
+static int remap_index(const svm_model *model, int index)
+{
+	int lo = 0, hi = model->nr_feature - 1;
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		int k = model->feature_lookup[mid];
+		int v = model->feature_map[k - 1];
+		if (v == index)
+			return k;
+		if (v < index)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return 0;
+}
+
+// writes the remapped row x, terminator included, to out; returns the number of nodes written
+static int remap_row(const svm_model *model, const svm_node *x, svm_node *out)
+{
+	// features not seen in training get distinct indices past nr_feature, so
+	// they still count in the norm of x (e.g. for RBF) but meet no SV feature
+	int n = 0, unseen = 0;
+	for (; x->index != -1; x++, n++)
+	{
+		int k = remap_index(model, x->index);
+		out[n].index = k ? k : model->nr_feature + (++unseen);
+		out[n].value = x->value;
+	}
+	qsort(out, n, sizeof(svm_node), compare_node_index);
+	out[n++].index = -1;
+	return n;
+}
+
+static svm_model *svm_train_remapped(const svm_problem *prob, const svm_parameter *param)
+{
+	int l = prob->l;
+	int i, k, n = 0;
+
+	// count how often each feature index is used
+	size_t elements = 0;
+	for (i = 0; i < l; i++)
+		for (const svm_node *x = prob->x[i]; x->index != -1; x++)
+			elements++;
+	int *indices = Malloc(int, max(elements, (size_t)1));
+	size_t j = 0;
+	for (i = 0; i < l; i++)
+		for (const svm_node *x = prob->x[i]; x->index != -1; x++)
+			indices[j++] = x->index;
+	qsort(indices, elements, sizeof(int), compare_int);
+	feature_count *counts = Malloc(feature_count, max(elements, (size_t)1));
+	for (j = 0; j < elements; j++)
+	{
+		if (n > 0 && counts[n - 1].index == indices[j])
+			counts[n - 1].count++;
+		else
+		{
+			counts[n].index = indices[j];
+			counts[n].count = 1;
+			n++;
+		}
+	}
+	free(indices);
+	qsort(counts, n, sizeof(feature_count), compare_feature_count);
+
+	svm_model map;
+	map.nr_feature = n;
+	map.feature_map = Malloc(int, max(n, 1));
+	for (k = 0; k < n; k++)
+		map.feature_map[k] = counts[k].index;
+	free(counts);
+	build_feature_lookup(&map);
+
+	svm_problem remapped;
+	remapped.l = l;
+	remapped.y = prob->y;
+	remapped.x = Malloc(svm_node *, l);
+	svm_node *x_space = Malloc(svm_node, elements + l);
+	j = 0;
+	for (i = 0; i < l; i++)
+	{
+		remapped.x[i] = &x_space[j];
+		j += remap_row(&map, prob->x[i], &x_space[j]);
+	}
+
+	svm_parameter remapped_param = *param;
+	remapped_param.remap_features = 0;
+	svm_model *model = svm_train(&remapped, &remapped_param);
+	model->param.remap_features = 1;
+	model->nr_feature = n;
+	model->feature_map = map.feature_map;
+	model->feature_lookup = map.feature_lookup;
+
+	// the SVs point into x_space; give the model its own copy
+	size_t sv_elements = 0;
+	for (i = 0; i < model->l; i++)
+	{
+		const svm_node *x = model->SV[i];
+		while ((x++)->index != -1);
+		sv_elements += x - model->SV[i];
+	}
+	if (model->l > 0)
+	{
+		svm_node *sv_space = Malloc(svm_node, sv_elements);
+		j = 0;
+		for (i = 0; i < model->l; i++)
+		{
+			const svm_node *x = model->SV[i];
+			model->SV[i] = &sv_space[j];
+			do
+				sv_space[j++] = *x;
+			while ((x++)->index != -1);
+		}
+		model->free_sv = 1;
+	}
+
+	free(x_space);
+	free(remapped.x);
+	return model;
+}
+
+//
+// State shared by the subproblems of the outermost svm_train (or svm_cross_validation)
+// on this thread: the device session holding its rows, and the pooled buffers, which
+// are released when it returns
+//
+static thread_local int train_depth;
+
+class TrainSession {
+public:
+	TrainSession(const svm_problem *prob, const svm_parameter *param) : cuda_session(false)
+	{
+		// remapped features and reordered rows are copies, which the subproblems upload themselves
+		if (train_depth++ == 0 && param->cuda_flag == 1 && !param->remap_features && !param->reorder_rows &&
+			cudaSession == nullptr)
+		{
+			cudaSession = new CudaSession(*prob); // CUDA INTEGRATION
+			cuda_session = true;
+		}
+	}
+	~TrainSession()
+	{
+		if (cuda_session)
+		{
+			delete cudaSession;
+			cudaSession = nullptr;
+		}
+		if (--train_depth == 0)
+		{
+			host_memory_pool().trim();
+			device_memory_pool().trim();
+		}
+	}
+private:
+	bool cuda_session;
+};
+
 svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 {
+	if (param->remap_features)
+		return svm_train_remapped(prob, param);
+
+	TrainSession session(prob, param);
 	cudaSolver = nullptr; // CUDA INTEGRATION
 	svm_model *model = Malloc(svm_model, 1);
 	model->param = *param;
 	model->free_sv = 0;	// XXX
+	model->nr_feature = 0;
+	model->feature_map = NULL;
+	model->feature_lookup = NULL;
 
 	if (param->svm_type == ONE_CLASS ||
 		param->svm_type == EPSILON_SVR ||
@@ -2279,10 +3813,25 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 				sub_prob.y[ci + k] = -1;
 			}
 
+			// the probability folds and the model share the kernel rows of the pair
+			// in a table taking half of the cache
+			svm_parameter pair_param = *param;
+			KernelTable *table = NULL;
+			if (param->probability && param->cuda_flag == 0 && !param->reorder_rows && param->approx_landmarks == 0)
+			{
+				pair_param.cache_size = param->cache_size / 2;
+				table = new KernelTable(sub_prob, *param, (long int)(pair_param.cache_size*(1 << 20)));
+			}
+			const KernelTable *outer_table = kernel_table;
+			if (table)
+				kernel_table = table;
+
 			if (param->probability)
-				svm_binary_svc_probability(&sub_prob, param, weighted_C[i], weighted_C[j], probA[p], probB[p]);
+				svm_binary_svc_probability(&sub_prob, &pair_param, weighted_C[i], weighted_C[j], probA[p], probB[p], CV_STREAM + 1 + p);
 
-			f[p] = svm_train_one(&sub_prob, param, weighted_C[i], weighted_C[j]);
+			f[p] = svm_train_one(&sub_prob, &pair_param, weighted_C[i], weighted_C[j]);
+			kernel_table = outer_table;
+			delete table;
 			for (k = 0; k < ci; k++)
 				if (!nonzero[si + k] && fabs(f[p].alpha[k]) > 0)
 					nonzero[si + k] = true;
@@ -2406,11 +3955,13 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 // Stratified cross validation
 void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, int nr_fold, double *target)
 {
+	TrainSession session(prob, param); // the folds share the rows of prob
 	int i;
 	int *fold_start;
 	int l = prob->l;
 	int *perm = Malloc(int, l);
 	int nr_class;
+	Random rnd(param->seed, CV_STREAM);
 	if (nr_fold > l)
 	{
 		nr_fold = l;
@@ -2436,7 +3987,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for (c = 0; c < nr_class; c++)
 			for (i = 0; i < count[c]; i++)
 			{
-			int j = i + rand() % (count[c] - i);
+			int j = i + rnd.next(count[c] - i);
 			swap(index[start[c] + j], index[start[c] + i]);
 			}
 		for (i = 0; i < nr_fold; i++)
@@ -2473,7 +4024,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for (i = 0; i < l; i++) perm[i] = i;
 		for (i = 0; i < l; i++)
 		{
-			int j = i + rand() % (l - i);
+			int j = i + rnd.next(l - i);
 			swap(perm[i], perm[j]);
 		}
 		for (i = 0; i <= nr_fold; i++)
@@ -2566,7 +4117,25 @@ double svm_get_svr_probability(const svm_model *model)
 	}
 }
 
+static double predict_values(const svm_model *model, const svm_node *x, double* dec_values);
+
 double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+{
+	if (model->feature_map == NULL)
+		return predict_values(model, x, dec_values);
+
+	// apply the feature remapping of the training set
+	int n = 0;
+	while (x[n].index != -1)
+		n++;
+	svm_node *remapped = Malloc(svm_node, n + 1);
+	remap_row(model, x, remapped);
+	double pred_result = predict_values(model, remapped, dec_values);
+	free(remapped);
+	return pred_result;
+}
+
+static double predict_values(const svm_model *model, const svm_node *x, double* dec_values)
 {
 	int i;
 	if (model->param.svm_type == ONE_CLASS ||
@@ -2771,6 +4340,14 @@ int svm_save_model(const char *model_file_name, const svm_model *model)
 		fprintf(fp, "\n");
 	}
 
+	if (model->feature_map)
+	{
+		fprintf(fp, "feature_map %d", model->nr_feature);
+		for (int i = 0; i < model->nr_feature; i++)
+			fprintf(fp, " %d", model->feature_map[i]);
+		fprintf(fp, "\n");
+	}
+
 	fprintf(fp, "SV\n");
 	const double * const *sv_coef = model->sv_coef;
 	const svm_node * const *SV = model->SV;
@@ -2918,6 +4495,16 @@ bool read_model_header(FILE *fp, svm_model* model)
 			for (int i = 0; i < n; i++)
 				FSCANF(fp, "%d", &model->nSV[i]);
 		}
+		else if (strcmp(cmd, "feature_map") == 0)
+		{
+			FSCANF(fp, "%d", &model->nr_feature);
+			int n = model->nr_feature;
+			model->feature_map = Malloc(int, max(n, 1));
+			for (int i = 0; i < n; i++)
+				FSCANF(fp, "%d", &model->feature_map[i]);
+			build_feature_lookup(model);
+			param.remap_features = 1;
+		}
 		else if (strcmp(cmd, "SV") == 0)
 		{
 			while (1)
@@ -2955,6 +4542,9 @@ svm_model *svm_load_model(const char *model_file_name)
 	model->sv_indices = NULL;
 	model->label = NULL;
 	model->nSV = NULL;
+	model->nr_feature = 0;
+	model->feature_map = NULL;
+	model->feature_lookup = NULL;
 
 	// read header
 	if (!read_model_header(fp, model))
@@ -2965,6 +4555,8 @@ svm_model *svm_load_model(const char *model_file_name)
 		free(model->rho);
 		free(model->label);
 		free(model->nSV);
+		free(model->feature_map);
+		free(model->feature_lookup);
 		free(model);
 		return NULL;
 	}
@@ -3076,6 +4668,12 @@ void svm_free_model_content(svm_model* model_ptr)
 
 	free(model_ptr->nSV);
 	model_ptr->nSV = NULL;
+
+	free(model_ptr->feature_map);
+	model_ptr->feature_map = NULL;
+
+	free(model_ptr->feature_lookup);
+	model_ptr->feature_lookup = NULL;
 }
 
 void svm_free_and_destroy_model(svm_model** model_ptr_ptr)
@@ -3154,6 +4752,69 @@ const char *svm_check_parameter(const svm_problem *prob, const svm_parameter *pa
 		param->probability != 1)
 		return "probability != 0 and probability != 1";
 
+	if (param->gradient_refresh < 0)
+		return "gradient_refresh < 0";
+
+	if (param->telemetry_interval < 0)
+		return "telemetry_interval < 0";
+
+	if (param->time_budget < 0)
+		return "time_budget < 0";
+
+	if (param->objective_window < 0 || param->objective_tol < 0)
+		return "objective_window < 0 or objective_tol < 0";
+
+	if (param->eps_stages < 0)
+		return "eps_stages < 0";
+
+	if (param->remap_features != 0 &&
+		param->remap_features != 1)
+		return "remap_features != 0 and remap_features != 1";
+
+	if (param->remap_features && param->kernel_type == PRECOMPUTED)
+		return "feature remapping not supported with precomputed kernel";
+
+	if (param->reorder_rows != 0 &&
+		param->reorder_rows != 1)
+		return "reorder_rows != 0 and reorder_rows != 1";
+
+	if (param->index_compression != 0 &&
+		param->index_compression != 1)
+		return "index_compression != 0 and index_compression != 1";
+
+	if (param->compact_cache != 0 &&
+		param->compact_cache != 1)
+		return "compact_cache != 0 and compact_cache != 1";
+
+	if (param->fused_select != 0 &&
+		param->fused_select != 1)
+		return "fused_select != 0 and fused_select != 1";
+
+	if (param->check_interval < 0)
+		return "check_interval < 0";
+
+	if (param->approx_landmarks < 0)
+		return "approx_landmarks < 0";
+
+	if (param->approx_landmarks > 0 &&
+		(svm_type != C_SVC || (kernel_type != LINEAR && kernel_type != POLY && kernel_type != RBF)))
+		return "approximate training only supports C-SVC with linear, polynomial or RBF kernel";
+
+	if (param->approx_landmarks > 0 && param->cuda_flag == 1)
+		return "approximate training does not use CUDA";
+
+	if (param->cache_precision != CACHE_FLOAT &&
+		param->cache_precision != CACHE_BF16)
+		return "unknown cache precision";
+
+	if (param->cuda_flag == 1 &&
+		param->cache_precision != CACHE_FLOAT)
+		return "bfloat16 kernel cache not supported with cuda";
+
+	if (param->compensated_gradient != 0 &&
+		param->compensated_gradient != 1)
+		return "compensated_gradient != 0 and compensated_gradient != 1";
+
 	if (param->probability == 1 &&
 		svm_type == ONE_CLASS)
 		return "one-class SVM probability output not supported yet";
@@ -3230,3 +4891,84 @@ void svm_set_print_string_function(void(*print_func)(const char *))
 	else
 		svm_print_string = print_func;
 }
+
+MemoryPool<HostAllocator> &host_memory_pool()
+{
+	static MemoryPool<HostAllocator> pool;
+	return pool;
+}
+
+void svm_get_memory_stats(svm_memory_stats *host, svm_memory_stats *device)
+{
+	if (host)
+		host_memory_pool().get_stats(host);
+	if (device)
+		device_memory_pool().get_stats(device);
+}
+
+//
+// Replays the iterations of a working-set trace through a Cache of cache_size MB:
+// Q_i and Q_j are requested as Solver::Solve does, misses are filled with zeros
+// instead of kernel evaluations, and the gradient is updated
+// with the recorded alpha deltas, so lookups and updates can be timed apart
+//
+template <class T> static void replay_trace(const svm_trace_header *header, const svm_trace_record *record,
+	Cache& cache, int compact_cache, svm_replay_stats *stats)
+{
+	int l = header->l, active_size = l;
+	double *G = new double[l];
+	for (int k = 0; k < l; k++)
+		G[k] = 0;
+
+	for (int r = 0; r < header->nr_record; r++)
+	{
+		int i = record[r].i, j = record[r].j, len = record[r].active_size;
+		if (len < 0)
+		{
+			cache.swap_index(i, j);
+			swap(G[i], G[j]);
+			continue;
+		}
+		if (compact_cache && len < active_size)
+			cache.truncate(len); // as do_shrinking
+		active_size = len;
+
+		double start_time = wall_time();
+		T *Q_i, *Q_j;
+		int start = cache.get_data(i, &Q_i, len);
+		for (int k = start; k < len; k++)
+			Q_i[k] = T();
+		stats->filled += max(len - start, 0);
+		if (start < len) ++stats->misses; else ++stats->hits;
+		// Q_i is used after Q_j is fetched, so it must survive the lookup of Q_j
+		start = cache.get_data(j, &Q_j, len);
+		for (int k = start; k < len; k++)
+			Q_j[k] = T();
+		stats->filled += max(len - start, 0);
+		if (start < len) ++stats->misses; else ++stats->hits;
+		double update_start = wall_time();
+		stats->cache_time += update_start - start_time;
+
+		double delta_alpha_i = record[r].delta_alpha_i, delta_alpha_j = record[r].delta_alpha_j;
+		for (int k = 0; k < len; k++)
+			G[k] += to_Qfloat(Q_i[k]) * delta_alpha_i + to_Qfloat(Q_j[k]) * delta_alpha_j;
+		stats->update_time += wall_time() - update_start;
+	}
+	delete[] G;
+}
+
+void svm_replay_trace(const svm_trace_header *header, const svm_trace_record *record,
+	double cache_size, int cache_precision, int compact_cache, svm_replay_stats *stats)
+{
+	memset(stats, 0, sizeof(svm_replay_stats));
+	if (cache_precision == CACHE_BF16)
+	{
+		Cache cache(header->l, (long int)(cache_size*(1 << 20)), sizeof(Qbf16));
+		replay_trace<Qbf16>(header, record, cache, compact_cache, stats);
+	}
+	else
+	{
+		Cache cache(header->l, (long int)(cache_size*(1 << 20)));
+		replay_trace<Qfloat>(header, record, cache, compact_cache, stats);
+	}
+}
@@ -43,6 +43,82 @@ struct svm_problem
 
 enum { C_SVC, NU_SVC, ONE_CLASS, EPSILON_SVR, NU_SVR };	/* svm_type */
 enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED }; /* kernel_type */
+enum { CACHE_FLOAT, CACHE_BF16 };	/* cache_precision */
+enum { TELEMETRY_SAMPLE, TELEMETRY_STAGE, TELEMETRY_SUMMARY };	/* svm_telemetry event */
+enum { STOP_OPTIMAL, STOP_MAX_ITER, STOP_TIME_BUDGET, STOP_OBJECTIVE_STALL };	/* svm_telemetry stop_reason */
+
+/* phases of svm_train timed for telemetry; on the CUDA path device work is
+   asynchronous and is charged to the phase that waits for it */
+enum {
+	PHASE_LOAD,		/* building the kernel and loading the problem (onto the device) */
+	PHASE_INIT_GRADIENT,	/* initial gradient */
+	PHASE_SELECT,		/* working set selection */
+	PHASE_KERNEL,		/* fetching or computing the working set column Q_i */
+	PHASE_UPDATE,		/* alpha and gradient update, including the lazily computed part of Q_j */
+	PHASE_SHRINK,		/* shrinking */
+	PHASE_RECONSTRUCT,	/* gradient reconstruction and refresh */
+	PHASE_RHO,		/* rho and objective value */
+	NR_PHASE
+};
+
+struct svm_telemetry
+{
+	int event;		/* TELEMETRY_SAMPLE, TELEMETRY_STAGE or TELEMETRY_SUMMARY */
+	int l;			/* size of the subproblem being solved */
+	int iter;
+	int active_size;
+	double kkt_gap;		/* maximal violating pair gap of the last working set selection */
+	double cache_hit_rate;	/* fraction of kernel column requests served by the cache, < 0 if unknown */
+	double phase_time[NR_PHASE];	/* wall-clock seconds spent in each phase so far */
+
+	/* TELEMETRY_STAGE and TELEMETRY_SUMMARY only; for a stage solved with
+	   shrinking, rho is estimated from the active set */
+	double obj;
+	double rho;
+	double eps;		/* tolerance the solution satisfies */
+	int stop_reason;	/* TELEMETRY_SUMMARY only */
+};
+
+/* working-set trace (param.trace_file): for every subproblem solved, a
+   svm_trace_header followed by nr_record svm_trace_records, in host byte order */
+#define SVM_TRACE_MAGIC 0x54435254	/* "TRCT" */
+
+struct svm_trace_header
+{
+	int magic;		/* SVM_TRACE_MAGIC */
+	int svm_type;
+	int l;			/* size of the subproblem, 2*l for regression */
+	int cache_precision;
+	double cache_size;	/* in MB */
+	int nr_record;
+	int cuda;		/* 1 if solved on the device, where the alpha deltas are not known */
+};
+
+struct svm_trace_record
+{
+	int i, j;		/* working set, in the permuted order of the solver */
+	int active_size;	/* < 0: not an iteration but shrinking swapping indices i and j */
+	float delta_alpha_i, delta_alpha_j;
+};
+
+/* replay of a trace through the CPU kernel column Cache and gradient update */
+struct svm_replay_stats
+{
+	long hits, misses;	/* column requests of Q_i and Q_j */
+	double filled;		/* column elements computed on misses */
+	double cache_time;	/* seconds in Cache lookups, with misses filled by placeholder values */
+	double update_time;	/* seconds in the gradient update */
+};
+
+/* pooled allocators of the per-subproblem arrays (svm_get_memory_stats), in bytes */
+struct svm_memory_stats
+{
+	long long current;	/* in use */
+	long long peak;		/* maximum of current */
+	long long reserved;	/* held, including blocks kept for reuse; released when svm_train returns */
+	long long allocations;	/* requests served by the underlying allocator */
+	long long reuses;	/* requests served by a kept block */
+};
 
 struct svm_parameter
 {
@@ -64,6 +140,31 @@ struct svm_parameter
 	double p;	/* for EPSILON_SVR */
 	int shrinking;	/* use the shrinking heuristics */
 	int probability; /* do probability estimates */
+	int gradient_refresh;	/* recompute the gradient from scratch every gradient_refresh iterations (0 to disable) */
+	int compensated_gradient;	/* accumulate gradient updates with Kahan compensation */
+	int cache_precision;	/* element type of cached kernel columns */
+	int seed;	/* seed for the shuffles of cross validation and probability estimates */
+
+	/* early stopping; the solution reached so far is used, with rho computed from it */
+	double time_budget;	/* wall-clock seconds per subproblem, including loading it (0 for no limit) */
+	int objective_window;	/* stop when the objective decreased by less than objective_tol*max(1,|obj|) */
+	double objective_tol;	/* over the last objective_window iterations (0 to disable) */
+	int remap_features;	/* renumber the features of the training set 1..d by decreasing frequency */
+	int reorder_rows;	/* sort the rows of each subproblem by a MinHash of their feature indices for locality */
+	int eps_stages;	/* solve to eps*10^(eps_stages-1) first, then tighten eps tenfold per stage (0 or 1: one stage) */
+	int approx_landmarks;	/* C_SVC: train on a Nystrom feature map of this many sampled rows (0 for exact training) */
+	int index_compression;	/* CPU kernel: keep the feature indices group-varint delta coded */
+	int compact_cache;	/* CPU kernel: truncate cached columns to the active set when shrinking */
+	int fused_select;	/* find i of the next working set in the same sweep as the gradient update */
+	int check_interval;	/* act on the stopping condition every check_interval iterations (0 or 1: every one); CUDA: the host waits for the device only then */
+	const char *trace_file;	/* append the working-set trace of every subproblem to this file (NULL: off) */
+
+	/* telemetry: telemetry(event, telemetry_data) is called every telemetry_interval
+	   iterations (0 for summaries only) and once after each binary subproblem;
+	   NULL disables it.  It may be called concurrently from several threads. */
+	void (*telemetry)(const struct svm_telemetry *event, void *telemetry_data);
+	void *telemetry_data;
+	int telemetry_interval;
 };
 
 //
@@ -81,6 +182,11 @@ struct svm_model
 	double *probB;
 	int *sv_indices;        /* sv_indices[0,...,nSV-1] are values in [1,...,num_traning_data] to indicate SVs in the training set */
 
+	/* feature remapping (param.remap_features); SVs use the new indices */
+	int nr_feature;		/* number of features seen in training */
+	int *feature_map;	/* feature_map[k] is the input index of feature k+1, NULL if not remapped */
+	int *feature_lookup;	/* 1..nr_feature sorted by input index, for lookups */
+
 	/* for classification only */
 
 	int *label;		/* label of each class (label[k]) */
@@ -117,6 +223,11 @@ int svm_check_probability_model(const struct svm_model *model);
 
 void svm_set_print_string_function(void (*print_func)(const char *));
 
+void svm_get_memory_stats(struct svm_memory_stats *host, struct svm_memory_stats *device);
+
+void svm_replay_trace(const struct svm_trace_header *header, const struct svm_trace_record *record,
+	double cache_size, int cache_precision, int compact_cache, struct svm_replay_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -47,6 +47,13 @@ const double libsvm_cuda_version = 0.318;
 #endif
 #endif
 
+// for code shared by the device kernels and host tools
+#ifdef __CUDACC__
+#define HOST_DEVICE __host__ __device__
+#else
+#define HOST_DEVICE
+#endif
+
 #define USE_BITVECTOR_FORMAT 0 // Experimental: bit vector format
 #define USE_SPARSE_BITVECTOR_FORMAT 0 // Experimental: sparse bit vector format
 #define DEBUG_VERIFY 	0	// for verifying ... more critical than debugging
@@ -106,15 +113,6 @@ typedef float2 cuda_svm_node;
 typedef float1 cuda_svm_node;
 #endif
 
-struct ALIGN(8) CacheNode {
-	struct CacheNode *next; // next node in LRU list
-	struct CacheNode *prev; // previous node in LRU list
-	int col_idx;   // column that this buffer currently represents
-	int stage_idx; // column that this buffer is being modifed for
-	bool used; // cache node is currently being read
-	CValue_t *column; // buffer for column "col_idx", unless it is being staged
-};
-
 #define WORD_SIZE 	32
 
 #define TAU 1e-12
@@ -70,12 +70,15 @@ __constant__	double			d_Cn;
 __device__		GradValue_t		*d_G;
 __device__		GradValue_t		*d_alpha;
 __device__		char			*d_alpha_status;
+__device__		GradValue_t		*d_G_comp;		// Kahan compensation of d_G, NULL if disabled
+__device__		double			*d_G_refresh;	// double precision accumulator used to refresh d_G
 
 __device__		GradValue_t		d_delta_alpha_i;
 __device__		GradValue_t		d_delta_alpha_j;
 
 __device__		int2			d_solver; // member x and y hold the selected i and j working set indices respectively
-__device__		int2			d_nu_solver; // member x and y hold the Gmaxp_idx and Gmaxn_idx indices respectively.  
+__device__		int2			d_nu_solver; // member x and y hold the Gmaxp_idx and Gmaxn_idx indices respectively.
+__device__		device_select_status	d_select; // result of the last Gmax reduction and the convergence state  
 
 cudaError_t update_sparse_vector(uint32_t *dh_sparse_vector, int sparse_vector_size, int *dh_bitvector_table, int bitvector_table_size, int max_words)
 {
@@ -227,6 +230,53 @@ cudaError_t update_rbf_variables(CValue_t *dh_x_square)
 	return err;
 }
 
+cudaError_t get_working_set(int *i, int *j)
+{
+	int2 ws;
+	cudaError_t err = cudaMemcpyFromSymbol(&ws, d_solver, sizeof(int2));
+	if (err != cudaSuccess) {
+		fprintf(stderr, "Error copying from symbol d_solver\n");
+		return err;
+	}
+	*i = ws.x;
+	*j = ws.y;
+	return err;
+}
+
+cudaError_t get_select_status(device_select_status *status)
+{
+	cudaError_t err = cudaMemcpyFromSymbol(status, d_select, sizeof(device_select_status));
+	if (err != cudaSuccess)
+		fprintf(stderr, "Error copying from symbol d_select\n");
+	return err;
+}
+
+cudaError_t reset_select_status()
+{
+	device_select_status status;
+	memset(&status, 0, sizeof(status));
+	cudaError_t err = cudaMemcpyToSymbol(d_select, &status, sizeof(status));
+	if (err != cudaSuccess)
+		fprintf(stderr, "Error copying to symbol d_select\n");
+	return err;
+}
+
+cudaError_t update_gradient_shadow(GradValue_t *dh_G_comp, double *dh_G_refresh)
+{
+	cudaError_t err;
+	err = cudaMemcpyToSymbol(d_G_comp, &dh_G_comp, sizeof(dh_G_comp));
+	if (err != cudaSuccess) {
+		fprintf(stderr, "Error copying to symbol d_G_comp\n");
+		return err;
+	}
+	err = cudaMemcpyToSymbol(d_G_refresh, &dh_G_refresh, sizeof(dh_G_refresh));
+	if (err != cudaSuccess) {
+		fprintf(stderr, "Error copying to symbol d_G_refresh\n");
+		return err;
+	}
+	return err;
+}
+
 void unbind_texture()
 {
 	cudaUnbindTexture(d_tex_space);
@@ -724,9 +774,13 @@ void device_compute_obj_diff(int i, int j, CValue_t Qij, GradValue_t Gmax, CValu
 }
 
 __global__ 
-void cuda_compute_obj_diff(GradValue_t Gmax, CValue_t *dh_obj_diff_array, int *result_indx, int N)
+void cuda_compute_obj_diff(CValue_t *dh_obj_diff_array, int *result_indx, int N)
 {
+	if (d_select.converged)
+		return;
+
 	int i = d_solver.x;
+	GradValue_t Gmax = d_select.gmax[0];
 
 	for (int j = blockDim.x * blockIdx.x + threadIdx.x;
 		j < N;
@@ -748,9 +802,13 @@ void cuda_compute_obj_diff(GradValue_t Gmax, CValue_t *dh_obj_diff_array, int *r
 }
 
 __global__ 
-void cuda_compute_obj_diff_SVR(GradValue_t Gmax, CValue_t *dh_obj_diff_array, int *result_indx, int N)
+void cuda_compute_obj_diff_SVR(CValue_t *dh_obj_diff_array, int *result_indx, int N)
 {
+	if (d_select.converged)
+		return;
+
 	int i = d_solver.x;
+	GradValue_t Gmax = d_select.gmax[0];
 
 	for (int j = blockDim.x * blockIdx.x + threadIdx.x;
 		j < N;
@@ -776,9 +834,84 @@ void cuda_compute_obj_diff_SVR(GradValue_t Gmax, CValue_t *dh_obj_diff_array, in
 	}
 }
 
+__device__	__forceinline__ 
+double device_get_C(int i)
+{
+	return (d_y[i] > 0) ? d_Cp : d_Cn;
+}
+
+/**
+Bound status of alpha_i as update_alpha_status() would set it
+*/
+__device__ __forceinline__
+char device_alpha_status(int i)
+{
+	if (d_alpha[i] >= device_get_C(i))
+		return UPPER_BOUND;
+	else if (d_alpha[i] <= 0)
+		return LOWER_BOUND;
+	else
+		return FREE;
+}
+
+/**
+Writes the candidates of t for Gmax (with its index) and Gmax2, given the bound status of alpha_t
+*/
+__device__ __forceinline__
+void device_prep_gmax(int t, char alpha_status, GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx)
+{
+	dh_gmax[t] = -GRADVALUE_MAX;
+	dh_gmax2[t] = -GRADVALUE_MAX;
+	dh_gmax_idx[t] = -1;
+	if (d_y[t] == +1)
+	{
+		if (!(alpha_status == UPPER_BOUND) /*is_upper_bound(t)*/) {
+			dh_gmax[t] = -d_G[t];
+			dh_gmax_idx[t] = t;
+		}
+		if (!(alpha_status == LOWER_BOUND) /*is_lower_bound(t)*/) {
+			dh_gmax2[t] = d_G[t];
+		}
+	}
+	else
+	{
+		if (!(alpha_status == LOWER_BOUND) /*is_lower_bound(t)*/) {
+			dh_gmax[t] = d_G[t];
+			dh_gmax_idx[t] = t;
+		}
+		if (!(alpha_status == UPPER_BOUND) /*is_upper_bound(t)*/) {
+			dh_gmax2[t] = -d_G[t];
+		}
+	}
+}
+
+/**
+Adds delta to G_k, with Kahan compensation if d_G_comp is set
+*/
+__device__ __forceinline__
+void device_add_gradient(int k, GradValue_t delta)
+{
+	if (d_G_comp == NULL) {
+		d_G[k] += delta;
+		return;
+	}
+	GradValue_t y = delta - d_G_comp[k];
+	GradValue_t t = d_G[k] + y;
+	d_G_comp[k] = (t - d_G[k]) - y;
+	d_G[k] = t;
+}
+
+/**
+Updates G for the step on alpha_i and alpha_j.  If dh_gmax is set, the candidates for
+the next Gmax and Gmax2 are also written as by cuda_prep_gmax, with the bound status
+of alpha_i and alpha_j taken from their new values (cuda_update_alpha_status runs later)
+*/
 __global__ 
-void cuda_update_gradient(int N)
+void cuda_update_gradient(GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N)
 {
+	if (d_select.converged)
+		return;
+
 	int i = d_solver.x; // selected i index
 	int j = d_solver.y; // selected j index
 
@@ -807,13 +940,21 @@ void cuda_update_gradient(int N)
 			Qj[k] = Qjk;
 		}
 
-		d_G[k] += (Qik* d_delta_alpha_i + Qjk * d_delta_alpha_j);
+		device_add_gradient(k, Qik* d_delta_alpha_i + Qjk * d_delta_alpha_j);
+
+		if (dh_gmax) {
+			char status = (k == i || k == j) ? device_alpha_status(k) : d_alpha_status[k];
+			device_prep_gmax(k, status, dh_gmax, dh_gmax2, dh_gmax_idx);
+		}
 	}
 }
 
 __global__ 
-void cuda_update_gradient_SVR(int N)
+void cuda_update_gradient_SVR(GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N)
 {
+	if (d_select.converged)
+		return;
+
 	int i = d_solver.x; // selected i index
 	int j = d_solver.y; // selected j index
 
@@ -847,8 +988,16 @@ void cuda_update_gradient_SVR(int N)
 			Qj[k + d_l] = Qjk2;
 		}
 
-		d_G[k] += (Qik1 * d_delta_alpha_i + Qjk1 * d_delta_alpha_j);
-		d_G[k + d_l] += (Qik2 * d_delta_alpha_i + Qjk2 * d_delta_alpha_j);
+		device_add_gradient(k, Qik1 * d_delta_alpha_i + Qjk1 * d_delta_alpha_j);
+		device_add_gradient(k + d_l, Qik2 * d_delta_alpha_i + Qjk2 * d_delta_alpha_j);
+
+		if (dh_gmax) {
+			int k2 = k + d_l;
+			char status = (k == i || k == j) ? device_alpha_status(k) : d_alpha_status[k];
+			device_prep_gmax(k, status, dh_gmax, dh_gmax2, dh_gmax_idx);
+			status = (k2 == i || k2 == j) ? device_alpha_status(k2) : d_alpha_status[k2];
+			device_prep_gmax(k2, status, dh_gmax, dh_gmax2, dh_gmax_idx);
+		}
 	}
 }
 
@@ -871,6 +1020,46 @@ void cuda_init_gradient(int start, int step, int N)
 	d_G[j] += acc;
 }
 
+/**
+Accumulates alpha_i * Q_ij for i in [start, start+step) into d_G_refresh[j] in double precision
+*/
+__global__ 
+void cuda_refresh_gradient(int start, int step, int N)
+{
+	int j = blockIdx.x * blockDim.x + threadIdx.x;
+	if (j >= N)
+		return;
+
+	double acc = 0;
+	for (int i = start; i < N && i < start + step; ++i)
+	{
+		if (!(d_alpha_status[i] == LOWER_BOUND) /*is_lower_bound(i)*/)
+		{
+			acc += (double)d_alpha[i] * cuda_evalQ(i, j);
+		}
+	}
+
+	d_G_refresh[j] += acc;
+}
+
+/**
+Replaces d_G with the refreshed gradient and clears the compensation terms
+*/
+__global__ 
+void cuda_commit_gradient(int N)
+{
+	if (d_select.converged) // keep the gradient the solver converged on
+		return;
+
+	for (int k = blockIdx.x * blockDim.x + threadIdx.x; 
+		k < N;
+		k += blockDim.x * gridDim.x) {
+		d_G[k] = static_cast<GradValue_t>(d_G_refresh[k]);
+		if (d_G_comp != NULL)
+			d_G_comp[k] = 0;
+	}
+}
+
 #if USE_DOUBLE_GRADIENT // needed if we are storing double gradient values
 /**
 double version of atomicAdd
@@ -1041,8 +1230,17 @@ void cuda_find_gmax(find_gmax_param param, int N, bool debug)
 
 	device_block_reducer(func, N); // Template function defined in CudaReducer.h
 
-	if (blockIdx.x == 0 && threadIdx.x == 0)
+	if (blockIdx.x == 0 && threadIdx.x == 0) {
 		d_solver.x = func.return_idx();
+		if (gridDim.x == 1 && !d_select.converged) { // last pass of cross_block_reducer
+			GradValue_t gmax, gmax2;
+			func.return_values(gmax, gmax2);
+			d_select.gmax[0] = gmax;
+			d_select.gmax2[0] = gmax2;
+			d_select.kkt_gap = gmax + gmax2;
+			d_select.converged = d_select.kkt_gap < param.eps;
+		}
+	}
 }
 
 __global__ 
@@ -1075,40 +1273,17 @@ void cuda_prep_gmax(GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_id
 	if (t >= N)
 		return;
 
-	dh_gmax[t] = -GRADVALUE_MAX;
-	dh_gmax2[t] = -GRADVALUE_MAX;
-	dh_gmax_idx[t] = -1;
-	if (d_y[t] == +1)
-	{
-		if (!(d_alpha_status[t] == UPPER_BOUND) /*is_upper_bound(t)*/) {
-			dh_gmax[t] = -d_G[t];
-			dh_gmax_idx[t] = t;
-		}
-		if (!(d_alpha_status[t] == LOWER_BOUND) /*is_lower_bound(t)*/) {
-			dh_gmax2[t] = d_G[t];
-		}
-	}
-	else
-	{
-		if (!(d_alpha_status[t] == LOWER_BOUND) /*is_lower_bound(t)*/) {
-			dh_gmax[t] = d_G[t];
-			dh_gmax_idx[t] = t;
-		}
-		if (!(d_alpha_status[t] == UPPER_BOUND) /*is_upper_bound(t)*/) {
-			dh_gmax2[t] = -d_G[t];
-		}
-	}
-}
-
-__device__	__forceinline__ 
-double device_get_C(int i)
-{
-	return (d_y[i] > 0) ? d_Cp : d_Cn;
+	device_prep_gmax(t, d_alpha_status[t], dh_gmax, dh_gmax2, dh_gmax_idx);
 }
 
 __global__ 
 void cuda_compute_alpha()
 {
+	if (d_select.converged) {
+		++d_select.idle;
+		return;
+	}
+
 	int i = d_solver.x; // d_selected_i;
 	int j = d_solver.y; // d_selected_j;
 
@@ -1211,17 +1386,15 @@ void cuda_compute_alpha()
 __device__ 
 void device_update_alpha_status(int i)
 {
-	if (d_alpha[i] >= device_get_C(i))
-		d_alpha_status[i] = UPPER_BOUND;
-	else if (d_alpha[i] <= 0)
-		d_alpha_status[i] = LOWER_BOUND;
-	else
-		d_alpha_status[i] = FREE;
+	d_alpha_status[i] = device_alpha_status(i);
 }
 
 __global__ 
 void cuda_update_alpha_status()
 {
+	if (d_select.converged)
+		return;
+
 	int i = d_solver.x;
 	int j = d_solver.y;
 
@@ -1329,10 +1502,15 @@ void device_compute_nu_obj_diff(int ip, int in, int j, CValue_t Qipj, GradValue_
 }
 
 __global__ 
-void cuda_compute_nu_obj_diff(GradValue_t Gmaxp, GradValue_t Gmaxn, CValue_t *dh_obj_diff_array, int *result_idx, int N)
+void cuda_compute_nu_obj_diff(CValue_t *dh_obj_diff_array, int *result_idx, int N)
 {
+	if (d_select.converged)
+		return;
+
 	int ip = d_nu_solver.x;
 	int in = d_nu_solver.y;
+	GradValue_t Gmaxp = d_select.gmax[0];
+	GradValue_t Gmaxn = d_select.gmax[1];
 
 	for (int j = blockDim.x * blockIdx.x + threadIdx.x;
 		j < N;
@@ -1354,10 +1532,15 @@ void cuda_compute_nu_obj_diff(GradValue_t Gmaxp, GradValue_t Gmaxn, CValue_t *dh
 }
 
 __global__ 
-void cuda_compute_nu_obj_diff_SVR(GradValue_t Gmaxp, GradValue_t Gmaxn, CValue_t *dh_obj_diff_array, int *result_idx, int N)
+void cuda_compute_nu_obj_diff_SVR(CValue_t *dh_obj_diff_array, int *result_idx, int N)
 {
+	if (d_select.converged)
+		return;
+
 	int ip = d_nu_solver.x;
 	int in = d_nu_solver.y;
+	GradValue_t Gmaxp = d_select.gmax[0];
+	GradValue_t Gmaxn = d_select.gmax[1];
 
 	for (int j = blockDim.x * blockIdx.x + threadIdx.x;
 		j < N;
@@ -1398,6 +1581,11 @@ void cuda_find_nu_gmax(find_nu_gmax_param param, int N)
 		func.return_idx(ip, in);
 		d_nu_solver.x = ip;
 		d_nu_solver.y = in;
+		if (gridDim.x == 1 && !d_select.converged) { // last pass of cross_block_reducer
+			func.return_values(d_select.gmax[0], d_select.gmax[1], d_select.gmax2[0], d_select.gmax2[1]);
+			d_select.kkt_gap = max(d_select.gmax[0] + d_select.gmax2[0], d_select.gmax[1] + d_select.gmax2[1]);
+			d_select.converged = d_select.kkt_gap < param.eps;
+		}
 	}
 }
 
@@ -1430,24 +1618,24 @@ void launch_cuda_setup_QD(size_t num_blocks, size_t block_size, int N)
 }
 
 
-void launch_cuda_compute_obj_diff(size_t num_blocks, size_t block_size, GradValue_t Gmax, CValue_t *dh_obj_diff_array, int *result_idx, int N)
+void launch_cuda_compute_obj_diff(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_idx, int N)
 {
-	cuda_compute_obj_diff << <num_blocks, block_size >> > (Gmax, dh_obj_diff_array, result_idx, N);
+	cuda_compute_obj_diff << <num_blocks, block_size >> > (dh_obj_diff_array, result_idx, N);
 }
 
-void launch_cuda_compute_obj_diff_SVR(size_t num_blocks, size_t block_size, GradValue_t Gmax, CValue_t *dh_obj_diff_array, int *result_idx, int N)
+void launch_cuda_compute_obj_diff_SVR(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_idx, int N)
 {
-	cuda_compute_obj_diff_SVR << <num_blocks, block_size >> > (Gmax, dh_obj_diff_array, result_idx, N);
+	cuda_compute_obj_diff_SVR << <num_blocks, block_size >> > (dh_obj_diff_array, result_idx, N);
 }
 
-void launch_cuda_update_gradient(size_t num_blocks, size_t block_size, int N)
+void launch_cuda_update_gradient(size_t num_blocks, size_t block_size, GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N)
 {
-	cuda_update_gradient << <num_blocks, block_size >> > (N);
+	cuda_update_gradient << <num_blocks, block_size >> > (dh_gmax, dh_gmax2, dh_gmax_idx, N);
 }
 
-void launch_cuda_update_gradient_SVR(size_t num_blocks, size_t block_size, int N)
+void launch_cuda_update_gradient_SVR(size_t num_blocks, size_t block_size, GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N)
 {
-	cuda_update_gradient_SVR << <num_blocks, block_size >> > (N);
+	cuda_update_gradient_SVR << <num_blocks, block_size >> > (dh_gmax, dh_gmax2, dh_gmax_idx, N);
 }
 
 void launch_cuda_init_gradient(size_t num_blocks, size_t block_size, int start, int step, int N)
@@ -1455,6 +1643,16 @@ void launch_cuda_init_gradient(size_t num_blocks, size_t block_size, int start,
 	cuda_init_gradient << < num_blocks, block_size>> > (start, step, N);
 }
 
+void launch_cuda_refresh_gradient(size_t num_blocks, size_t block_size, int start, int step, int N)
+{
+	cuda_refresh_gradient << < num_blocks, block_size>> > (start, step, N);
+}
+
+void launch_cuda_commit_gradient(size_t num_blocks, size_t block_size, int N)
+{
+	cuda_commit_gradient << < num_blocks, block_size>> > (N);
+}
+
 void launch_cuda_prep_gmax(size_t num_blocks, size_t block_size, GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N)
 {
 	cuda_prep_gmax << < num_blocks, block_size>> > (dh_gmax, dh_gmax2, dh_gmax_idx, N);
@@ -1490,14 +1688,14 @@ void launch_cuda_find_nu_gmax(size_t num_blocks, size_t block_size, size_t share
 	cuda_find_nu_gmax << <num_blocks, block_size, share_mem_size >> >(param, N);
 }
 
-void launch_cuda_compute_nu_obj_diff(size_t num_blocks, size_t block_size, GradValue_t Gmaxp, GradValue_t Gmaxn, CValue_t *dh_obj_diff_array, int *result_idx, int N)
+void launch_cuda_compute_nu_obj_diff(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_idx, int N)
 {
-	cuda_compute_nu_obj_diff << <num_blocks, block_size >> > (Gmaxp, Gmaxn, dh_obj_diff_array, result_idx, N);
+	cuda_compute_nu_obj_diff << <num_blocks, block_size >> > (dh_obj_diff_array, result_idx, N);
 }
 
-void launch_cuda_compute_nu_obj_diff_SVR(size_t num_blocks, size_t block_size, GradValue_t Gmaxp, GradValue_t Gmaxn, CValue_t *dh_obj_diff_array, int *result_idx, int N)
+void launch_cuda_compute_nu_obj_diff_SVR(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_idx, int N)
 {
-	cuda_compute_nu_obj_diff_SVR << <num_blocks, block_size >> > (Gmaxp, Gmaxn, dh_obj_diff_array, result_idx, N);
+	cuda_compute_nu_obj_diff_SVR << <num_blocks, block_size >> > (dh_obj_diff_array, result_idx, N);
 }
 
 void launch_cuda_prep_nu_gmax(size_t num_blocks, size_t block_size, GradValue_t *dh_gmaxp, GradValue_t *dh_gmaxn, GradValue_t *dh_gmaxp2, GradValue_t *dh_gmaxn2,
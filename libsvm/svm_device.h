@@ -19,6 +19,7 @@
 #ifndef _CUDA_DEVICE_FUNCTION_H_
 #define _CUDA_DEVICE_FUNCTION_H_
 #include "svm_defs.h"
+#include "lru_policy.h"
 
 /*********** Device function kernels ************/
 
@@ -26,16 +27,20 @@ void launch_cuda_setup_x_square(size_t num_blocks, size_t block_size, int N);
 
 void launch_cuda_setup_QD(size_t num_blocks, size_t block_size, int N);
 
-void launch_cuda_compute_obj_diff(size_t num_blocks, size_t block_size, GradValue_t Gmax, CValue_t *dh_obj_diff_array, int *result_indx, int N);
+void launch_cuda_compute_obj_diff(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_indx, int N);
 
-void launch_cuda_compute_obj_diff_SVR(size_t num_blocks, size_t block_size, GradValue_t Gmax, CValue_t *dh_obj_diff_array, int *result_indx, int N);
+void launch_cuda_compute_obj_diff_SVR(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_indx, int N);
 
-void launch_cuda_update_gradient(size_t num_blocks, size_t block_size, int N);
+void launch_cuda_update_gradient(size_t num_blocks, size_t block_size, GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N);
 
-void launch_cuda_update_gradient_SVR(size_t num_blocks, size_t block_size, int N);
+void launch_cuda_update_gradient_SVR(size_t num_blocks, size_t block_size, GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N);
 
 void launch_cuda_init_gradient(size_t num_blocks, size_t block_size, int start, int step, int N);
 
+void launch_cuda_refresh_gradient(size_t num_blocks, size_t block_size, int start, int step, int N);
+
+void launch_cuda_commit_gradient(size_t num_blocks, size_t block_size, int N);
+
 void launch_cuda_prep_gmax(size_t num_blocks, size_t block_size, GradValue_t *dh_gmax, GradValue_t *dh_gmax2, int *dh_gmax_idx, int N);
 
 void launch_cuda_compute_alpha(size_t num_blocks, size_t block_size);
@@ -50,6 +55,7 @@ struct find_gmax_param
 	GradValue_t *result_gmax;
 	GradValue_t *result_gmax2;
 	int *result_gmax_idx;
+	GradValue_t eps; // stopping tolerance, checked by the last pass
 };
 /**
 cuda_find_gmax:
@@ -79,6 +85,7 @@ struct find_nu_gmax_param
 	GradValue_t *result_gmaxn2;
 	int *result_gmaxp_idx;
 	int *result_gmaxn_idx;
+	GradValue_t eps; // stopping tolerance, checked by the last pass
 };
 
 /**
@@ -93,9 +100,31 @@ shared memory requirement: block_size * (sizeof(CValue_t) + sizeof(int))
 */
 void launch_cuda_find_nu_min_idx(size_t num_blocks, size_t block_size, size_t share_mem_size, CValue_t *obj_diff_array, int *obj_diff_indx, CValue_t *result_obj_min, int *result_indx, int N);
 
-void launch_cuda_compute_nu_obj_diff(size_t num_blocks, size_t block_size, GradValue_t Gmaxp, GradValue_t Gmaxn, CValue_t *dh_obj_diff_array, int *result_indx, int N);
+void launch_cuda_compute_nu_obj_diff(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_indx, int N);
 
-void launch_cuda_compute_nu_obj_diff_SVR(size_t num_blocks, size_t block_size, GradValue_t Gmaxp, GradValue_t Gmaxn, CValue_t *dh_obj_diff_array, int *result_indx, int N);
+void launch_cuda_compute_nu_obj_diff_SVR(size_t num_blocks, size_t block_size, CValue_t *dh_obj_diff_array, int *result_indx, int N);
+
+/**
+Result of the last Gmax reduction, kept on the device so that iterations need not wait
+for the host: the last pass of cuda_find_gmax (cuda_find_nu_gmax) records the maxima and
+sets converged once the gap is below eps, and from then on the kernels of an iteration
+do nothing, with cuda_compute_alpha counting them in idle.  The values are not updated
+while converged is set.
+*/
+struct device_select_status
+{
+	GradValue_t gmax[2]; // Gmax, or Gmaxp and Gmaxn
+	GradValue_t gmax2[2]; // Gmax2, or Gmaxp2 and Gmaxn2
+	GradValue_t kkt_gap;
+	int converged;
+	int idle; // iterations launched since converged was set
+};
+
+cudaError_t get_select_status(device_select_status *status);
+
+cudaError_t get_working_set(int *i, int *j); // i and j of the last selection (d_solver)
+
+cudaError_t reset_select_status(); // clears converged and idle
 
 void launch_cuda_prep_nu_gmax(size_t num_blocks, size_t block_size, GradValue_t *dh_gmaxp, GradValue_t *dh_gmaxn, GradValue_t *dh_gmaxp2, GradValue_t *dh_gmaxn2, int *dh_gmaxp_idx, int *dh_gmaxn_idx, int N);
 
@@ -104,6 +133,8 @@ cudaError_t update_solver_variables(SChar_t *dh_y, CValue_t *dh_QD, GradValue_t
 
 cudaError_t update_rbf_variables(CValue_t *dh_x_square);
 
+cudaError_t update_gradient_shadow(GradValue_t *dh_G_comp, double *dh_G_refresh);
+
 cudaError_t update_param_constants(const svm_parameter &param, int *dh_x, cuda_svm_node *dh_space, size_t dh_space_size, int l);
 
 void unbind_texture();
@@ -116,6 +147,7 @@ cudaError_t update_sparse_vector(uint32_t *dh_sparse_vector, int sparse_vector_s
 
 /***** LRU Column Cache *******/
 void show_device_cache_stats();
-void setup_device_LRU_cache(CacheNode **dh_columns, CValue_t * dh_column_space, int space, int col_size);
+double get_device_cache_hit_rate();
+void setup_device_LRU_cache(const LRUCachePolicy &cache);
 
 #endif
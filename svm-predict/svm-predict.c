@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "svm.h"
+
+#define Malloc(type,n) (type *)malloc((n)*sizeof(type))
+#define DEFAULT_BATCH_SIZE 4096	// rows parsed, then scored in parallel, at a time
+
+int print_null(const char *s,...) {return 0;}
+
+static int (*info)(const char *fmt,...) = &printf;
+
+struct svm_model* model;
+int predict_probability=0;
+int batch_size=DEFAULT_BATCH_SIZE;
+
+static char *line = NULL;
+static int max_line_len;
+
+// one batch of test rows
+static double *target;
+static struct svm_node **x;
+static int *row_start;	// offset of each row in x_space
+static struct svm_node *x_space;
+static int max_elements;
+static double *predict_label;
+static double *prob_estimates;
+
+// per-row scoring latency, over all batches
+static double *latency;
+static int max_latency;
+
+static char* readline(FILE *input)
+{
+	int len;
+
+	if(fgets(line,max_line_len,input) == NULL)
+		return NULL;
+
+	while(strrchr(line,'\n') == NULL)
+	{
+		max_line_len *= 2;
+		line = (char *) realloc(line,max_line_len);
+		len = (int) strlen(line);
+		if(fgets(line+len,max_line_len-len,input) == NULL)
+			break;
+	}
+	return line;
+}
+
+void exit_input_error(int line_num)
+{
+	fprintf(stderr,"Wrong input format at line %d\n", line_num);
+	exit(1);
+}
+
+static double wall_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// parse "label index:value ..." from line into x_space[j,...); returns the new j
+static int parse_row(int row, int j, int line_num)
+{
+	char *p = line, *endptr;
+	int inst_max_index = -1; // strtol gives 0 if wrong format, and precomputed kernel has <index> start from 0
+
+	while(isspace(*p)) ++p;
+	if(*p == '\0')	// empty line
+		exit_input_error(line_num);
+	target[row] = strtod(p,&endptr);
+	if(endptr == p || !isspace(*endptr))
+		exit_input_error(line_num);
+	p = endptr;
+
+	while(1)
+	{
+		while(isspace(*p)) ++p;
+		if(*p == '\0')
+			break;
+
+		if(j+1 >= max_elements)
+		{
+			max_elements *= 2;
+			x_space = (struct svm_node *) realloc(x_space,max_elements*sizeof(struct svm_node));
+		}
+
+		errno = 0;
+		x_space[j].index = (int) strtol(p,&endptr,10);
+		if(endptr == p || errno != 0 || *endptr != ':' || x_space[j].index <= inst_max_index)
+			exit_input_error(line_num);
+		inst_max_index = x_space[j].index;
+		p = endptr+1;
+
+		errno = 0;
+		x_space[j].value = strtod(p,&endptr);
+		if(endptr == p || errno != 0 || (*endptr != '\0' && !isspace(*endptr)))
+			exit_input_error(line_num);
+		p = endptr;
+		++j;
+	}
+	if(j >= max_elements)	// a row without features after a full buffer
+	{
+		max_elements *= 2;
+		x_space = (struct svm_node *) realloc(x_space,max_elements*sizeof(struct svm_node));
+	}
+	x_space[j++].index = -1;
+	return j;
+}
+
+void predict(FILE *input, FILE *output)
+{
+	int correct = 0;
+	int total = 0;
+	double error = 0;
+	double sump = 0, sumt = 0, sumpp = 0, sumtt = 0, sumpt = 0;
+	double parse_time = 0, score_time = 0, t;
+	int nr_thread = 1;
+
+	int svm_type=svm_get_svm_type(model);
+	int nr_class=svm_get_nr_class(model);
+	int classify_probability = predict_probability && (svm_type==C_SVC || svm_type==NU_SVC);
+	int *labels=NULL;
+	int i, j, n;
+
+	if(predict_probability)
+	{
+		if (svm_type==NU_SVR || svm_type==EPSILON_SVR)
+			info("Prob. model for test data: target value = predicted value + z,\nz: Laplace distribution e^(-|z|/sigma)/(2sigma),sigma=%g\n",svm_get_svr_probability(model));
+		else
+		{
+			labels=(int *) malloc(nr_class*sizeof(int));
+			svm_get_labels(model,labels);
+			fprintf(output,"labels");
+			for(j=0;j<nr_class;j++)
+				fprintf(output," %d",labels[j]);
+			fprintf(output,"\n");
+			free(labels);
+		}
+	}
+
+	max_line_len = 1024;
+	line = (char *)malloc(max_line_len*sizeof(char));
+	max_elements = 64*batch_size;
+	x_space = Malloc(struct svm_node,max_elements);
+	target = Malloc(double,batch_size);
+	x = Malloc(struct svm_node *,batch_size);
+	row_start = Malloc(int,batch_size);
+	predict_label = Malloc(double,batch_size);
+	if(classify_probability)
+		prob_estimates = Malloc(double,(size_t)batch_size*nr_class);
+	max_latency = batch_size;
+	latency = Malloc(double,max_latency);
+#ifdef _OPENMP
+	nr_thread = omp_get_max_threads();
+#endif
+
+	while(1)
+	{
+		// parse a batch; x[] is set afterwards since x_space may move
+		t = wall_time();
+		for(n=0,j=0;n<batch_size && readline(input) != NULL;n++)
+		{
+			row_start[n] = j;
+			j = parse_row(n,j,total+n+1);
+		}
+		for(i=0;i<n;i++)
+			x[i] = &x_space[row_start[i]];
+		parse_time += wall_time() - t;
+		if(n == 0)
+			break;
+
+		if(total+n > max_latency)
+		{
+			while(total+n > max_latency)
+				max_latency *= 2;
+			latency = (double *) realloc(latency,max_latency*sizeof(double));
+		}
+
+		// score the batch in parallel
+		t = wall_time();
+#pragma omp parallel for schedule(dynamic, 64)
+		for(i=0;i<n;i++)
+		{
+			double start = wall_time();
+			if(classify_probability)
+				predict_label[i] = svm_predict_probability(model,x[i],&prob_estimates[(size_t)i*nr_class]);
+			else
+				predict_label[i] = svm_predict(model,x[i]);
+			latency[total+i] = wall_time() - start;
+		}
+		score_time += wall_time() - t;
+
+		// write results in input order
+		for(i=0;i<n;i++)
+		{
+			if(classify_probability)
+			{
+				fprintf(output,"%g",predict_label[i]);
+				for(j=0;j<nr_class;j++)
+					fprintf(output," %g",prob_estimates[(size_t)i*nr_class+j]);
+				fprintf(output,"\n");
+			}
+			else
+				fprintf(output,"%g\n",predict_label[i]);
+
+			if(predict_label[i] == target[i])
+				++correct;
+			error += (predict_label[i]-target[i])*(predict_label[i]-target[i]);
+			sump += predict_label[i];
+			sumt += target[i];
+			sumpp += predict_label[i]*predict_label[i];
+			sumtt += target[i]*target[i];
+			sumpt += predict_label[i]*target[i];
+		}
+		total += n;
+	}
+
+	if (svm_type==NU_SVR || svm_type==EPSILON_SVR)
+	{
+		info("Mean squared error = %g (regression)\n",error/total);
+		info("Squared correlation coefficient = %g (regression)\n",
+			((total*sumpt-sump*sumt)*(total*sumpt-sump*sumt))/
+			((total*sumpp-sump*sump)*(total*sumtt-sumt*sumt))
+			);
+	}
+	else if(total > 0)
+		info("Accuracy = %g%% (%d/%d) (classification)\n",
+			(double)correct/total*100,correct,total);
+
+	if(total > 0)
+	{
+		qsort(latency,total,sizeof(double),compare_double);
+		info("Throughput = %g rows/s (%d rows scored in %g s with %d threads, %g s parsing)\n",
+			total/score_time,total,score_time,nr_thread,parse_time);
+		info("Latency per row: p50 = %g us, p90 = %g us, p99 = %g us\n",
+			1e6*latency[(int)(0.50*(total-1))],
+			1e6*latency[(int)(0.90*(total-1))],
+			1e6*latency[(int)(0.99*(total-1))]);
+	}
+
+	free(x_space);
+	free(target);
+	free(x);
+	free(row_start);
+	free(predict_label);
+	free(prob_estimates);
+	free(latency);
+	free(line);
+}
+
+void exit_with_help()
+{
+	printf(
+	"Usage: svm-predict [options] test_file model_file output_file\n"
+	"options:\n"
+	"-b probability_estimates: whether to predict probability estimates, 0 or 1 (default 0); for one-class SVM only 0 is supported\n"
+	"-n nr_thread : number of scoring threads (default: all available)\n"
+	"-B batch_size : number of rows parsed and scored at a time (default %d)\n"
+	"-q : quiet mode (no outputs)\n",
+	DEFAULT_BATCH_SIZE
+	);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *input, *output;
+	int i;
+	// parse options
+	for(i=1;i<argc;i++)
+	{
+		if(argv[i][0] != '-') break;
+		++i;
+		switch(argv[i-1][1])
+		{
+			case 'b':
+				predict_probability = atoi(argv[i]);
+				break;
+			case 'n':
+#ifdef _OPENMP
+				if(atoi(argv[i]) > 0)
+					omp_set_num_threads(atoi(argv[i]));
+#endif
+				break;
+			case 'B':
+				batch_size = atoi(argv[i]);
+				if(batch_size < 1)
+				{
+					fprintf(stderr,"batch_size must be >= 1\n");
+					exit_with_help();
+				}
+				break;
+			case 'q':
+				info = &print_null;
+				i--;
+				break;
+			default:
+				fprintf(stderr,"Unknown option: -%c\n", argv[i-1][1]);
+				exit_with_help();
+		}
+	}
+
+	if(i>=argc-2)
+		exit_with_help();
+
+	input = fopen(argv[i],"r");
+	if(input == NULL)
+	{
+		fprintf(stderr,"can't open input file %s\n",argv[i]);
+		exit(1);
+	}
+
+	output = fopen(argv[i+2],"w");
+	if(output == NULL)
+	{
+		fprintf(stderr,"can't open output file %s\n",argv[i+2]);
+		exit(1);
+	}
+
+	if((model=svm_load_model(argv[i+1]))==0)
+	{
+		fprintf(stderr,"can't open model file %s\n",argv[i+1]);
+		exit(1);
+	}
+
+	if(predict_probability)
+	{
+		if(svm_check_probability_model(model)==0)
+		{
+			fprintf(stderr,"Model does not support probabiliy estimates\n");
+			exit(1);
+		}
+	}
+	else
+	{
+		if(svm_check_probability_model(model)!=0)
+			info("Model supports probability estimates, but disabled in prediction.\n");
+	}
+
+	predict(input,output);
+	svm_free_and_destroy_model(&model);
+	fclose(input);
+	fclose(output);
+	return 0;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
 #include "svm.h"
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
@@ -37,7 +38,27 @@ void exit_with_help()
 		"-h shrinking : whether to use the shrinking heuristics, 0 or 1 (default 1)\n"
 		"-b probability_estimates : whether to train a SVC or SVR model for probability estimates, 0 or 1 (default 0)\n"
 		"-wi weight : set the parameter C of class i to weight*C, for C-SVC (default 1)\n"
+		"-G n : recompute the gradient from scratch every n iterations, 0 to disable (default 0)\n"
+		"-K compensated : whether to accumulate gradient updates with Kahan compensation, 0 or 1 (default 0)\n"
+		"-Q precision : set element type of cached kernel columns (default 0)\n"
+		"	0 -- float\n"
+		"	1 -- bfloat16 (twice the columns in the same cache size)\n"
+		"-V : report objective and rho deltas of -Q precision against a float cache\n"
 		"-v n: n-fold cross validation mode\n"
+		"-S seed : set seed of the random shuffles in cross validation and probability estimates (default 1)\n"
+		"-L seconds : stop each subproblem early after this much wall-clock time (default 0, no limit)\n"
+		"-W n : stop early when the objective improves too little over n iterations (default 0, off)\n"
+		"-D tol : relative objective improvement per -W window below which to stop (default 1e-5)\n"
+		"-F remap : whether to renumber the features 1..d by decreasing frequency, 0 or 1 (default 0)\n"
+		"-R reorder : whether to reorder the rows of each subproblem by shared features for locality, 0 or 1 (default 0)\n"
+		"-E n : solve in n stages, from eps*10^(n-1) down to eps (default 1)\n"
+		"-A m : C-SVC only: approximate training on a Nystrom feature map of m sampled rows (default 0, exact)\n"
+		"-I compress : whether the CPU kernel keeps the feature indices group-varint delta coded, 0 or 1 (default 0)\n"
+		"-z compact : whether shrinking truncates the cached kernel columns to the active set, 0 or 1 (default 0)\n"
+		"-J fused : whether the gradient update also finds i of the next working set, saving a sweep, 0 or 1 (default 0)\n"
+		"-N n : check for convergence every n iterations; with CUDA the host then waits on the device only every n iterations (default 1)\n"
+		"-X file : write the working set of every iteration to file, for cache-replay\n"
+		"-T n : print phase timings, KKT gap and cache hit rate to stderr every n iterations and after each subproblem (0: after each subproblem only)\n"
 		"-q : quiet mode (no outputs)\n"
 		);
 	exit(1);
@@ -52,6 +73,7 @@ void exit_input_error(int line_num)
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name);
 void read_problem(const char *filename);
 void do_cross_validation();
+void do_precision_validation();
 
 struct svm_parameter param;		// set by parse_command_line
 struct svm_problem prob;		// set by read_problem
@@ -59,6 +81,62 @@ struct svm_model *model;
 struct svm_node *x_space;
 int cross_validation;
 int nr_fold;
+int precision_validation;
+
+// obj and rho of each solved subproblem, from the telemetry summaries for -V
+struct solution { double obj, rho; };
+struct solution *solutions;
+int nr_solution, max_solution;
+void (*solution_telemetry)(const struct svm_telemetry *, void *) = NULL;	// -T, if given
+
+static const char *stop_reason_name[] =
+{
+	"optimal", "max_iter", "time_budget", "objective_stall"
+};
+
+static const char *phase_name[NR_PHASE] =
+{
+	"load", "init_gradient", "select", "kernel", "update", "shrink", "reconstruct", "rho"
+};
+
+void print_telemetry(const struct svm_telemetry *t, void *data)
+{
+	int k;
+	if(t->event == TELEMETRY_SUMMARY)
+		fprintf(stderr,"telemetry: done l=%d iter=%d obj=%g rho=%g stop=%s",
+			t->l, t->iter, t->obj, t->rho, stop_reason_name[t->stop_reason]);
+	else if(t->event == TELEMETRY_STAGE)
+		fprintf(stderr,"telemetry: stage l=%d iter=%d active_size=%d eps=%g obj=%g rho=%g",
+			t->l, t->iter, t->active_size, t->eps, t->obj, t->rho);
+	else
+		fprintf(stderr,"telemetry: l=%d iter=%d active_size=%d gap=%g",
+			t->l, t->iter, t->active_size, t->kkt_gap);
+	if(t->cache_hit_rate >= 0)
+		fprintf(stderr," cache_hit_rate=%.4f", t->cache_hit_rate);
+	for(k=0;k<NR_PHASE;k++)
+		fprintf(stderr," %s=%.6fs", phase_name[k], t->phase_time[k]);
+	fprintf(stderr,"\n");
+}
+
+void collect_solution(const struct svm_telemetry *t, void *data)
+{
+	if(t->event == TELEMETRY_SUMMARY)
+	{
+#pragma omp critical(collect_solution)
+		{
+			if(nr_solution == max_solution)
+			{
+				max_solution = max_solution ? 2*max_solution : 16;
+				solutions = (struct solution *)realloc(solutions, sizeof(struct solution)*max_solution);
+			}
+			solutions[nr_solution].obj = t->obj;
+			solutions[nr_solution].rho = t->rho;
+			++nr_solution;
+		}
+	}
+	if(solution_telemetry)
+		solution_telemetry(t, data);
+}
 
 static char *line = NULL;
 static int max_line_len;
@@ -103,7 +181,10 @@ int main(int argc, char **argv)
 	}
 	else
 	{
-		model = svm_train(&prob,&param);
+		if(precision_validation)
+			do_precision_validation();
+		else
+			model = svm_train(&prob,&param);
 		if(svm_save_model(model_file_name,model))
 		{
 			fprintf(stderr, "can't save model to file %s\n", model_file_name);
@@ -159,6 +240,63 @@ void do_cross_validation()
 	free(target);
 }
 
+void do_precision_validation()
+{
+	static const char *precision_name[] = { "float", "bfloat16" };
+	struct svm_parameter compare_param = param, float_param;
+	struct svm_model *float_model, *compare_model;
+	int i, nr_float, nr_diff = 0;
+	double max_obj = 0, max_rho = 0, max_pred = 0;
+
+	// the cross validation folds of probability estimates are solved concurrently,
+	// so their summaries arrive in no fixed order; compare the models without them
+	compare_param.probability = 0;
+	float_param = compare_param;
+	float_param.cache_precision = CACHE_FLOAT;
+	float_model = svm_train(&prob,&float_param);
+	nr_float = nr_solution;
+	compare_model = svm_train(&prob,&compare_param);
+
+	printf("Cache precision validation: %s against float\n", precision_name[param.cache_precision]);
+	if(nr_solution != 2*nr_float)
+		printf("WARNING: %d subproblems solved with float, %d with %s\n",
+			nr_float, nr_solution-nr_float, precision_name[param.cache_precision]);
+	printf("#\tobj(float)\tobj\trel. delta\trho(float)\trho\tdelta\n");
+	for(i=0;i<nr_float && nr_float+i<nr_solution;i++)
+	{
+		struct solution *f = &solutions[i], *s = &solutions[nr_float+i];
+		double obj_delta = fabs(s->obj-f->obj)/(fabs(f->obj) > 0 ? fabs(f->obj) : 1);
+		double rho_delta = fabs(s->rho-f->rho);
+		printf("%d\t%g\t%g\t%g\t%g\t%g\t%g\n", i, f->obj, s->obj, obj_delta, f->rho, s->rho, rho_delta);
+		if(obj_delta > max_obj) max_obj = obj_delta;
+		if(rho_delta > max_rho) max_rho = rho_delta;
+	}
+	for(i=0;i<prob.l;i++)
+	{
+		double v = fabs(svm_predict(float_model,prob.x[i]) - svm_predict(compare_model,prob.x[i]));
+		if(v > max_pred) max_pred = v;
+		if(v != 0) ++nr_diff;
+	}
+	printf("Max relative obj delta = %g\n", max_obj);
+	printf("Max rho delta = %g\n", max_rho);
+	if(param.svm_type == EPSILON_SVR ||
+		param.svm_type == NU_SVR)
+		printf("Max training set prediction delta = %g\n", max_pred);
+	else
+		printf("Training set predictions changed = %d/%d\n", nr_diff, prob.l);
+	svm_free_and_destroy_model(&float_model);
+	free(solutions);
+
+	if(param.probability)
+	{
+		param.telemetry = solution_telemetry;
+		model = svm_train(&prob,&param);
+		svm_free_and_destroy_model(&compare_model);
+	}
+	else
+		model = compare_model;
+}
+
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name)
 {
 	int i;
@@ -178,10 +316,30 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 	param.p = 0.1;
 	param.shrinking = 1;
 	param.probability = 0;
+	param.gradient_refresh = 0;
+	param.compensated_gradient = 0;
+	param.cache_precision = CACHE_FLOAT;
+	param.seed = 1;
+	param.time_budget = 0;
+	param.objective_window = 0;
+	param.objective_tol = 1e-5;
+	param.eps_stages = 1;
+	param.reorder_rows = 0;
+	param.remap_features = 0;
+	param.approx_landmarks = 0;
+	param.index_compression = 0;
+	param.compact_cache = 0;
+	param.fused_select = 0;
+	param.check_interval = 1;
+	param.trace_file = NULL;
+	param.telemetry = NULL;
+	param.telemetry_data = NULL;
+	param.telemetry_interval = 0;
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
 	cross_validation = 0;
+	precision_validation = 0;
 
 	// parse options
 	for(i=1;i<argc;i++)
@@ -191,6 +349,10 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 			param.cuda_flag = 1;
 			continue;
 		}
+		if (argv[i][1] == 'V') {
+			precision_validation = 1;
+			continue;
+		}
 		if(++i>=argc)
 			exit_with_help();
 		switch(argv[i-1][1])
@@ -231,6 +393,58 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 		case 'b':
 			param.probability = atoi(argv[i]);
 			break;
+		case 'G':
+			param.gradient_refresh = atoi(argv[i]);
+			break;
+		case 'K':
+			param.compensated_gradient = atoi(argv[i]);
+			break;
+		case 'Q':
+			param.cache_precision = atoi(argv[i]);
+			break;
+		case 'S':
+			param.seed = atoi(argv[i]);
+			break;
+		case 'L':
+			param.time_budget = atof(argv[i]);
+			break;
+		case 'W':
+			param.objective_window = atoi(argv[i]);
+			break;
+		case 'D':
+			param.objective_tol = atof(argv[i]);
+			break;
+		case 'F':
+			param.remap_features = atoi(argv[i]);
+			break;
+		case 'R':
+			param.reorder_rows = atoi(argv[i]);
+			break;
+		case 'E':
+			param.eps_stages = atoi(argv[i]);
+			break;
+		case 'A':
+			param.approx_landmarks = atoi(argv[i]);
+			break;
+		case 'I':
+			param.index_compression = atoi(argv[i]);
+			break;
+		case 'z':
+			param.compact_cache = atoi(argv[i]);
+			break;
+		case 'J':
+			param.fused_select = atoi(argv[i]);
+			break;
+		case 'N':
+			param.check_interval = atoi(argv[i]);
+			break;
+		case 'X':
+			param.trace_file = argv[i];
+			break;
+		case 'T':
+			param.telemetry = &print_telemetry;
+			param.telemetry_interval = atoi(argv[i]);
+			break;
 		case 'q':
 			print_func = &print_null;
 			i--;
@@ -261,6 +475,22 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 		param.shrinking = 0;
 	}
 
+	if(param.trace_file)
+	{
+		// the library appends one trace per subproblem
+		FILE *fp = fopen(param.trace_file,"wb");
+		if(fp == NULL)
+		{
+			fprintf(stderr,"can't open trace file %s\n",param.trace_file);
+			exit(1);
+		}
+		fclose(fp);
+	}
+
+	if (precision_validation) {
+		solution_telemetry = param.telemetry;
+		param.telemetry = &collect_solution;
+	}
 	svm_set_print_string_function(print_func);
 
 	// determine filenames